@@ -0,0 +1,30 @@
+// Checks the controller report conversion against
+// Controller::GCtoDS4Reference() for every GameCube button state.
+//
+// ConversionCheck builds this without SIMD and ConversionCheckSimd with AVX2,
+// and both run it after linking, so a mismatch fails the build.
+//
+// Linux build, from the repository root (add -mssse3 for the SIMD path):
+//   g++ -std=c++20 -O2 -IGameCubeAdapterUnlimited
+//     -Ithirdparty/ViGEmClient/include Benchmarks/conversion_check.cpp
+//     -o conversion_check
+
+#include <iostream>
+
+#include "controller.hpp"
+
+int main() {
+#ifdef GCADAPTER_SIMD_CONVERSION
+  const char* path = "table and SIMD batch";
+#else
+  const char* path = "table and scalar batch";
+#endif
+  if (!Controller::VerifyConversion()) {
+    std::cerr << "Controller conversion (" << path
+              << ") does not match the reference" << std::endl;
+    return 1;
+  }
+  std::cout << "Controller conversion (" << path
+            << ") matches the reference" << std::endl;
+  return 0;
+}
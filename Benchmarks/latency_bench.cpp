@@ -0,0 +1,263 @@
+// End-to-end latency benchmark for the input and rumble paths.
+//
+// Drives AdapterThread with simulated adapters and a recording sink, and
+// reports latency percentiles for 1, 4, 16 and 64 adapters:
+// - Input: from a frame being published on the simulated endpoint 0x81 to its
+//   report being delivered to the sink.
+// - Rumble: from a sink rumble notification to the 0x11 payload being written
+//   to the simulated endpoint 0x02.
+// Input rows also report the process's context switches per published frame,
+// counted with getrusage() where it is available.
+//
+// Linux build, from the repository root:
+//   g++ -std=c++20 -O2 -pthread -IGameCubeAdapterUnlimited
+//     -Ithirdparty/ViGEmClient/include Benchmarks/latency_bench.cpp
+//     GameCubeAdapterUnlimited/simulated_adapter.cpp
+//     GameCubeAdapterUnlimited/input_log.cpp -o latency_bench
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+#include "adapter.hpp"
+#include "adapter_thread.hpp"
+#include "padsink.hpp"
+#include "simulated_adapter.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+namespace {
+
+struct Percentiles {
+  size_t samples = 0;
+  double p50 = 0;
+  double p99 = 0;
+  double p999 = 0;
+  double max = 0;
+};
+
+// Summarizes latencies given in nanoseconds, reported in microseconds.
+Percentiles Summarize(std::vector<int64_t>& latencies) {
+  Percentiles result;
+  result.samples = latencies.size();
+  if (latencies.empty()) {
+    return result;
+  }
+  std::sort(latencies.begin(), latencies.end());
+  auto at = [&](double quantile) {
+    const size_t index = std::min(
+        latencies.size() - 1, static_cast<size_t>(quantile * latencies.size()));
+    return latencies[index] / 1000.0;
+  };
+  result.p50 = at(0.5);
+  result.p99 = at(0.99);
+  result.p999 = at(0.999);
+  result.max = latencies.back() / 1000.0;
+  return result;
+}
+
+void Print(const char* path, size_t numAdapters, const Percentiles& p,
+           const std::string& switchesPerFrame) {
+  printf("%-7s %8zu %10zu %10.1f %10.1f %10.1f %10.1f %10s\n", path,
+         numAdapters, p.samples, p.p50, p.p99, p.p999, p.max,
+         switchesPerFrame.c_str());
+}
+
+// Voluntary and involuntary context switches of the whole process so far.
+// Returns false where they cannot be counted.
+bool ContextSwitches(uint64_t& switches) {
+#ifdef _WIN32
+  (void)switches;
+  return false;
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return false;
+  }
+  switches = usage.ru_nvcsw + usage.ru_nivcsw;
+  return true;
+#endif
+}
+
+uint64_t FramesSent(
+    const std::vector<std::shared_ptr<SimulatedAdapter>>& adapters) {
+  uint64_t frames = 0;
+  for (const auto& adapter : adapters) {
+    frames += adapter->FramesSent();
+  }
+  return frames;
+}
+
+// Records how long each report took to reach the sink, from the time its
+// frame was received.
+class RecordingSink : public MemoryPadSink {
+ public:
+  explicit RecordingSink(size_t expectedReports) {
+    latencies.reserve(expectedReports);
+  }
+
+  bool UpdatePad(size_t index, const DS4_REPORT& report,
+                 const FrameInfo& frame) override {
+    const Clock::time_point now = Clock::now();
+    if (recording && frame.sequence != 0) {
+      std::lock_guard<std::mutex> lock(latenciesMutex);
+      latencies.push_back((now - frame.received).count());
+    }
+    return MemoryPadSink::UpdatePad(index, report, frame);
+  }
+
+  std::vector<int64_t> TakeLatencies() {
+    std::lock_guard<std::mutex> lock(latenciesMutex);
+    return std::move(latencies);
+  }
+
+  std::atomic<bool> recording = false;
+
+ private:
+  std::mutex latenciesMutex;
+  std::vector<int64_t> latencies;
+};
+
+// Silences the feeder's connection messages while a scenario runs.
+class QuietOutput {
+  std::stringstream discard;
+  std::streambuf* saved;
+
+ public:
+  QuietOutput() : saved(std::cout.rdbuf(discard.rdbuf())) {}
+  ~QuietOutput() { std::cout.rdbuf(saved); }
+};
+
+struct Options {
+  unsigned int pollRateHz = 1000;
+  std::chrono::milliseconds duration{2000};
+  size_t rumbleSamples = 2000;
+  size_t inputThreads = 1;
+};
+
+void RunScenario(size_t numAdapters, const Options& options) {
+  std::vector<int64_t> inputLatencies;
+  std::vector<int64_t> rumbleLatencies;
+  std::string switchesPerFrame = "-";
+  {
+    QuietOutput quiet;
+    AdapterManager::Clear();
+
+    std::vector<std::shared_ptr<SimulatedAdapter>> adapters;
+    SimulatedAdapter::Options simulatedOptions;
+    simulatedOptions.pollRateHz = options.pollRateHz;
+    simulatedOptions.animateInputs = true;
+    for (size_t i = 0; i < numAdapters; i++) {
+      simulatedOptions.seed = static_cast<uint32_t>(i + 1);
+      adapters.push_back(std::make_shared<SimulatedAdapter>(simulatedOptions));
+      for (size_t port = 0; port < 4; port++) {
+        adapters.back()->PlugController(port);
+      }
+      AdapterManager::AddAdapter(adapters.back());
+    }
+
+    const size_t expectedReports =
+        numAdapters * 4 * options.pollRateHz *
+        static_cast<size_t>(options.duration.count() / 1000 + 1);
+    RecordingSink sink(expectedReports);
+    AdapterThread adapterThread(sink);
+    adapterThread.numWorkers = options.inputThreads;
+    adapterThread.SetupPads();
+    std::thread thread([&adapterThread]() { adapterThread.run(); });
+
+    // Let every controller connect before measuring.
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    uint64_t switchesBefore = 0;
+    const bool countSwitches = ContextSwitches(switchesBefore);
+    const uint64_t framesBefore = FramesSent(adapters);
+    sink.recording = true;
+    std::this_thread::sleep_for(options.duration);
+    sink.recording = false;
+    uint64_t switchesAfter = 0;
+    const uint64_t frames = FramesSent(adapters) - framesBefore;
+    if (countSwitches && ContextSwitches(switchesAfter) && frames > 0) {
+      char text[32];
+      snprintf(text, sizeof(text), "%.2f",
+               static_cast<double>(switchesAfter - switchesBefore) / frames);
+      switchesPerFrame = text;
+    }
+    inputLatencies = sink.TakeLatencies();
+
+    // Alternate rumble on and off across all pads, so every notification
+    // changes the payload.
+    rumbleLatencies.reserve(options.rumbleSamples);
+    for (size_t i = 0; i < options.rumbleSamples; i++) {
+      const size_t pad = i % (numAdapters * 4);
+      SimulatedAdapter& adapter = *adapters[pad / 4];
+      const size_t writesBefore = adapter.NumRumbleWrites();
+      const unsigned char motor = (i / (numAdapters * 4)) % 2 == 0 ? 0xFF : 0;
+      const Clock::time_point notified = Clock::now();
+      sink.SimulateRumble(pad, motor, motor);
+      const Clock::time_point deadline =
+          notified + std::chrono::milliseconds(100);
+      while (adapter.NumRumbleWrites() == writesBefore &&
+             Clock::now() < deadline) {
+        std::this_thread::yield();
+      }
+      if (adapter.NumRumbleWrites() == writesBefore) {
+        continue;
+      }
+      const Clock::time_point written = adapter.RumbleWrites().back().time;
+      rumbleLatencies.push_back((written - notified).count());
+    }
+
+    adapterThread.Stop();
+    thread.join();
+    AdapterManager::Clear();
+  }
+  Print("input", numAdapters, Summarize(inputLatencies), switchesPerFrame);
+  Print("rumble", numAdapters, Summarize(rumbleLatencies), "-");
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc &&
+        atoi(argv[i + 1]) > 0) {
+      options.pollRateHz = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--duration-ms") == 0 && i + 1 < argc &&
+               atoi(argv[i + 1]) > 0) {
+      options.duration = std::chrono::milliseconds(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--input-threads") == 0 && i + 1 < argc &&
+               atoi(argv[i + 1]) > 0) {
+      options.inputThreads = atoi(argv[++i]);
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--rate HZ] [--duration-ms MS] [--input-threads N]"
+                << std::endl;
+      return 1;
+    }
+  }
+
+  printf(
+      "Simulated adapters at %u Hz, %lld ms per scenario, %zu input "
+      "thread(s). Times in us.\n",
+      options.pollRateHz, static_cast<long long>(options.duration.count()),
+      options.inputThreads);
+  printf("%-7s %8s %10s %10s %10s %10s %10s %10s\n", "path", "adapters",
+         "samples", "p50", "p99", "p999", "max", "csw/frame");
+  for (size_t numAdapters : {1, 4, 16, 64}) {
+    RunScenario(numAdapters, options);
+  }
+  return 0;
+}
@@ -0,0 +1,375 @@
+// Microbenchmarks for the feeder's per-frame primitives.
+//
+// Reports the time and heap allocations per operation for controller report
+// conversion, frame handling, adapter table access under contention, the
+// pad lookup used by rumble notifications and input recording.
+//
+// Linux build, from the repository root (add -march=native to measure the
+// SIMD conversion path):
+//   g++ -std=c++20 -O2 -pthread -IGameCubeAdapterUnlimited
+//     -Ithirdparty/ViGEmClient/include Benchmarks/micro_bench.cpp
+//     GameCubeAdapterUnlimited/input_log.cpp -o micro_bench
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <memory>
+#include <new>
+#include <random>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "adapter.hpp"
+#include "controller.hpp"
+#include "input_log.hpp"
+#include "pad_lookup.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+// Every heap allocation in the process, to report allocations per operation.
+static std::atomic<uint64_t> g_allocations = 0;
+
+void* operator new(size_t size) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  if (void* p = malloc(size ? size : 1)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, std::align_val_t align) {
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  const size_t alignment = static_cast<size_t>(align);
+#ifdef _WIN32
+  void* p = _aligned_malloc(size ? size : 1, alignment);
+#else
+  // aligned_alloc wants a multiple of the alignment.
+  const size_t rounded = (size + alignment - 1) / alignment * alignment;
+  void* p = aligned_alloc(alignment, rounded ? rounded : alignment);
+#endif
+  if (p) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+void* operator new[](size_t size, std::align_val_t align) {
+  return operator new(size, align);
+}
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+// Aligned blocks need their own free function on Windows.
+static void FreeAligned(void* p) {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  free(p);
+#endif
+}
+void operator delete(void* p, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { FreeAligned(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+  FreeAligned(p);
+}
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+  FreeAligned(p);
+}
+
+namespace {
+
+// Keeps results alive so the compiler cannot drop the measured work.
+volatile uint64_t g_sink = 0;
+
+struct Options {
+  std::chrono::milliseconds minTime{200};
+  std::string filter;
+};
+
+// Runs op(iterations) with growing iteration counts until one run lasts at
+// least the minimum time, then prints the cost per iteration.
+template <typename Op>
+void Run(const Options& options, const std::string& name, Op&& op) {
+  if (!options.filter.empty() &&
+      name.find(options.filter) == std::string::npos) {
+    return;
+  }
+  op(size_t(100));  // Warm up.
+  size_t iterations = 1000;
+  while (true) {
+    const uint64_t allocationsBefore = g_allocations.load();
+    const Clock::time_point start = Clock::now();
+    op(iterations);
+    const Clock::duration elapsed = Clock::now() - start;
+    const uint64_t allocations = g_allocations.load() - allocationsBefore;
+    if (elapsed >= options.minTime || iterations >= (size_t(1) << 34)) {
+      const double ns =
+          std::chrono::duration<double, std::nano>(elapsed).count();
+      printf("%-36s %12.2f %12.3f\n", name.c_str(), ns / iterations,
+             static_cast<double>(allocations) / iterations);
+      return;
+    }
+    iterations *= 2;
+  }
+}
+
+// Discards everything written to it, so adapter connection messages cost
+// nothing.
+class NullBuffer : public std::streambuf {
+ protected:
+  int overflow(int c) override { return c; }
+};
+
+class QuietOutput {
+  NullBuffer discard;
+  std::streambuf* saved;
+
+ public:
+  QuietOutput() : saved(std::cout.rdbuf(&discard)) {}
+  ~QuietOutput() { std::cout.rdbuf(saved); }
+};
+
+// An adapter without a transport, that publishes frames on demand.
+class BenchAdapter : public Adapter {
+ public:
+  bool Write(unsigned char*, int) override { return true; }
+  void Publish(const Inputs& inputs) { PublishInputs(inputs); }
+};
+
+// Reads the adapter list in a loop on other threads.
+class ContendingReaders {
+  std::atomic<bool> stop = false;
+  std::vector<std::thread> threads;
+
+ public:
+  explicit ContendingReaders(size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      threads.emplace_back([this]() {
+        while (!stop.load(std::memory_order_relaxed)) {
+          AdapterManager::ReadGuard guard;
+          g_sink = AdapterManager::Get(0) != nullptr;
+        }
+      });
+    }
+  }
+  ~ContendingReaders() {
+    stop = true;
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+};
+
+std::vector<Controller::GCInput> RandomControllers(size_t count) {
+  std::minstd_rand random(1);
+  std::vector<Controller::GCInput> controllers(count);
+  for (Controller::GCInput& gc : controllers) {
+    gc.Status = 0x14;
+    gc.Buttons = static_cast<unsigned short>(random() & 0x0FFF);
+    gc.AnalogX = static_cast<unsigned char>(random());
+    gc.AnalogY = static_cast<unsigned char>(random());
+    gc.CStickX = static_cast<unsigned char>(random());
+    gc.CStickY = static_cast<unsigned char>(random());
+    gc.LeftTrigger = static_cast<unsigned char>(random());
+    gc.RightTrigger = static_cast<unsigned char>(random());
+  }
+  return controllers;
+}
+
+void BenchConversion(const Options& options) {
+  // A power of two, so indices wrap with a mask.
+  const size_t count = 1024;
+  const std::vector<Controller::GCInput> controllers = RandomControllers(count);
+
+  Run(options, "GCtoDS4Reference", [&](size_t iterations) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < iterations; i++) {
+      sum += Controller::GCtoDS4Reference(controllers[i & (count - 1)])
+                 .wButtons;
+    }
+    g_sink = sum;
+  });
+  Run(options, "GCtoDS4", [&](size_t iterations) {
+    uint64_t sum = 0;
+    for (size_t i = 0; i < iterations; i++) {
+      sum += Controller::GCtoDS4(controllers[i & (count - 1)]).wButtons;
+    }
+    g_sink = sum;
+  });
+#ifdef GCADAPTER_SIMD_CONVERSION
+  const char* batchName = "GCtoDS4 frame of 4 (SIMD)";
+#else
+  const char* batchName = "GCtoDS4 frame of 4 (scalar)";
+#endif
+  Run(options, batchName, [&](size_t iterations) {
+    DS4_REPORT reports[4];
+    uint64_t sum = 0;
+    for (size_t i = 0; i < iterations; i++) {
+      Controller::GCtoDS4(&controllers[(i * 4) & (count - 1)], reports, 4);
+      sum += reports[3].wButtons;
+    }
+    g_sink = sum;
+  });
+}
+
+void BenchInputs(const Options& options) {
+  // Raw frames as they arrive in an interrupt transfer buffer.
+  const size_t count = 256;
+  const std::vector<Controller::GCInput> controllers =
+      RandomControllers(count * 4);
+  std::vector<std::array<unsigned char, sizeof(Adapter::Inputs)>> buffers(
+      count);
+  for (size_t i = 0; i < count; i++) {
+    buffers[i][0] = 0x21;
+    memcpy(&buffers[i][1], &controllers[i * 4],
+           4 * sizeof(Controller::GCInput));
+  }
+
+  // What the input loop does with each frame: copy it out, check each port's
+  // connection and compare against the previous inputs.
+  Run(options, "Inputs parse", [&](size_t iterations) {
+    Adapter::Inputs previous;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < iterations; i++) {
+      Adapter::Inputs inputs;
+      memcpy(&inputs, buffers[i & (count - 1)].data(), sizeof(inputs));
+      for (size_t port = 0; port < 4; port++) {
+        Controller::GCInput& gc = inputs.Controllers[port];
+        sum += gc.On() &&
+               !Controller::SameInputs(gc, previous.Controllers[port]);
+      }
+      previous = inputs;
+    }
+    g_sink = sum;
+  });
+
+  BenchAdapter adapter;
+  Run(options, "Inputs publish + GetInputs", [&](size_t iterations) {
+    Adapter::Inputs inputs;
+    uint64_t sum = 0;
+    for (size_t i = 0; i < iterations; i++) {
+      adapter.Publish(
+          *reinterpret_cast<const Adapter::Inputs*>(buffers[i & (count - 1)]
+                                                        .data()));
+      sum += adapter.GetInputs(inputs);
+    }
+    g_sink = sum;
+  });
+}
+
+void BenchAdapterManager(const Options& options) {
+  QuietOutput quiet;
+  for (size_t readers : {0, 3}) {
+    AdapterManager::Clear();
+    // A typical large setup, with one free slot that Add and Remove reuse.
+    std::vector<std::shared_ptr<Adapter>> adapters;
+    for (size_t i = 0; i < 16; i++) {
+      adapters.push_back(std::make_shared<BenchAdapter>());
+      AdapterManager::AddAdapter(adapters.back());
+    }
+    auto extra = std::make_shared<BenchAdapter>();
+
+    ContendingReaders contention(readers);
+    const std::string suffix =
+        " (" + std::to_string(readers) + " readers)";
+    Run(options, "ReadGuard + Get" + suffix, [&](size_t iterations) {
+      uint64_t sum = 0;
+      for (size_t i = 0; i < iterations; i++) {
+        AdapterManager::ReadGuard guard;
+        sum += AdapterManager::Get(i & 15) != nullptr;
+      }
+      g_sink = sum;
+    });
+    Run(options, "AddAdapter + RemoveAdapter" + suffix, [&](size_t iterations) {
+      for (size_t i = 0; i < iterations; i++) {
+        AdapterManager::AddAdapter(extra);
+        AdapterManager::RemoveAdapter(extra.get());
+      }
+    });
+  }
+  AdapterManager::Clear();
+}
+
+void BenchPadLookup(const Options& options) {
+  for (size_t numPads : {4, 16, 64, 256}) {
+    // Stand-ins for the backend's pad handles.
+    std::vector<int> handles(numPads);
+    PadLookup lookup;
+    for (size_t i = 0; i < numPads; i++) {
+      lookup.Add(&handles[i], i);
+    }
+    // Look pads up in a shuffled order, like notifications from many games.
+    std::vector<const void*> keys;
+    for (size_t i = 0; i < 1024; i++) {
+      keys.push_back(&handles[(i * 7919) % numPads]);
+    }
+    Run(options, "PadLookup::Find (" + std::to_string(numPads) + " pads)",
+        [&](size_t iterations) {
+          uint64_t sum = 0;
+          for (size_t i = 0; i < iterations; i++) {
+            sum += lookup.Find(keys[i & 1023]);
+          }
+          g_sink = sum;
+        });
+  }
+}
+
+void BenchRecorder(const Options& options) {
+  const std::string path =
+      (std::filesystem::temp_directory_path() / "micro_bench_input.log")
+          .string();
+  {
+    InputRecorder recorder(path);
+    const std::vector<Controller::GCInput> controllers = RandomControllers(4);
+    Controller::GCInput frame[4];
+    std::copy(controllers.begin(), controllers.end(), frame);
+    FrameInfo info{Clock::now(), 0};
+    Run(options, "InputRecorder::RecordFrame", [&](size_t iterations) {
+      for (size_t i = 0; i < iterations; i++) {
+        info.sequence++;
+        recorder.RecordFrame(i & 127, frame, info);
+      }
+    });
+  }
+  std::filesystem::remove(path);
+}
+
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  Options options;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--min-time-ms") == 0 && i + 1 < argc &&
+        atoi(argv[i + 1]) > 0) {
+      options.minTime = std::chrono::milliseconds(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      options.filter = argv[++i];
+    } else {
+      std::cerr << "Usage: " << argv[0]
+                << " [--min-time-ms MS] [--filter SUBSTRING]" << std::endl;
+      return 1;
+    }
+  }
+
+  if (!Controller::VerifyConversion()) {
+    std::cerr << "Controller conversion does not match the reference"
+              << std::endl;
+    return 1;
+  }
+
+  printf("%-36s %12s %12s\n", "benchmark", "ns/op", "allocs/op");
+  BenchConversion(options);
+  BenchInputs(options);
+  BenchAdapterManager(options);
+  BenchPadLookup(options);
+  BenchRecorder(options);
+  return 0;
+}
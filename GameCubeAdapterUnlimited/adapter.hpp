@@ -0,0 +1,471 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "controller.hpp"
+#include "debug.hpp"
+#include "epoch.hpp"
+#include "frame_info.hpp"
+#include "input_log.hpp"
+#include "mailbox.hpp"
+#include "stats.hpp"
+
+// Wakes the input loop whenever any adapter publishes a new frame.
+class FrameSignal {
+  std::mutex mutex;
+  std::condition_variable cv;
+  uint64_t generation = 0;
+
+  // The signal whose notifications the calling thread is deferring, and
+  // whether any were deferred.
+  static inline thread_local FrameSignal* batching = nullptr;
+  static inline thread_local bool pending = false;
+
+ public:
+  // Defers the calling thread's notifications while it exists, and sends one
+  // for all of them at the end, so a burst of frames wakes waiters once.
+  // Nests.
+  class Batch {
+    FrameSignal& signal;
+    bool outermost;
+
+   public:
+    explicit Batch(FrameSignal& signal)
+        : signal(signal), outermost(batching == nullptr) {
+      if (outermost) {
+        batching = &signal;
+      }
+    }
+    ~Batch() {
+      if (!outermost) {
+        return;
+      }
+      batching = nullptr;
+      if (pending) {
+        pending = false;
+        signal.Notify();
+      }
+    }
+    Batch(const Batch&) = delete;
+    Batch& operator=(const Batch&) = delete;
+  };
+
+  void Notify() {
+    if (batching == this) {
+      pending = true;
+      return;
+    }
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      generation++;
+    }
+    cv.notify_all();
+  }
+  // Blocks until a frame newer than lastSeen is published or the timeout
+  // expires. Returns the latest generation, to be passed in on the next call.
+  uint64_t Wait(uint64_t lastSeen, std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait_for(lock, timeout, [&] { return generation != lastSeen; });
+    return generation;
+  }
+};
+
+// Bounds every write to an adapter, so a half-dead adapter is dropped in a
+// known time instead of hanging its writers.
+struct AdapterWritePolicy {
+  // Deadline for each attempt.
+  std::chrono::milliseconds timeout{100};
+  // Further attempts after a failed one, before the payload is given up.
+  unsigned int retries = 2;
+};
+
+// A GameCube controller adapter. Subclasses supply the transport: they deliver
+// frames through PublishInputs() and report failed reads, while this class
+// hands the newest frame to the input loop and tracks rumble state.
+class Adapter {
+ public:
+  struct Inputs {
+    // Padding to align inputs we get from the USB transfer with the Controller
+    // struct.
+    unsigned char _pad[1]{};
+    Controller::GCInput Controllers[4]{};
+  };
+  // A frame as received from the adapter.
+  struct Frame {
+    Inputs inputs;
+    FrameInfo info;
+  };
+
+  // Signalled by every adapter when it publishes new inputs.
+  static inline FrameSignal newInputs;
+  // Applies to adapters created after it is set.
+  static inline AdapterWritePolicy writePolicy;
+  // Receives every frame, rumble payload and disconnect of adapters in a
+  // slot, if set. Must outlive the adapters.
+  static inline InputRecorder* recorder = nullptr;
+
+  virtual ~Adapter() = default;
+
+  // Sends a payload to the adapter's output endpoint, within the bounds of
+  // writePolicy, and reports the outcome through RecordWrite() or
+  // RecordFailedWrite().
+  virtual bool Write(unsigned char* data, int length) = 0;
+
+  // Copies out the newest frame. Returns false if no frame arrived since the
+  // last call. Only one thread may consume an adapter's frames. Frames that
+  // were superseded before they could be consumed are counted as skipped.
+  bool GetFrame(Frame& frame) {
+    if (latestFrame.Sequence() ==
+        consumedSequence.load(std::memory_order_relaxed)) {
+      return false;
+    }
+    consumedSequence.store(latestFrame.Load(frame), std::memory_order_release);
+    const uint64_t expected = consumedFrame + 1;
+    if (frame.info.sequence > expected) {
+      stats.skippedFrames.fetch_add(frame.info.sequence - expected,
+                                    std::memory_order_relaxed);
+    } else if (frame.info.sequence < expected) {
+      stats.repeatedFrames.fetch_add(1, std::memory_order_relaxed);
+    }
+    consumedFrame = frame.info.sequence;
+    return true;
+  }
+  bool GetInputs(Inputs& inputs) {
+    Frame frame;
+    if (!GetFrame(frame)) {
+      return false;
+    }
+    inputs = frame.inputs;
+    return true;
+  }
+  // Whether the newest frame was consumed. Lets a transport that can produce
+  // frames faster than the input loop takes them, like a replay, wait for it.
+  bool FrameConsumed() const {
+    return latestFrame.Sequence() ==
+           consumedSequence.load(std::memory_order_acquire);
+  }
+  const AdapterStats& Stats() const { return stats; }
+  // The slot the adapter was added to, or SIZE_MAX.
+  size_t Slot() const { return slot.load(std::memory_order_relaxed); }
+  // Detect timeouts due to multiple failed reads or writes. An adapter that
+  // stops accepting writes is dropped after at most
+  // (MaxFailedWrites + 1) * (retries + 1) * timeout.
+  bool ShouldDisconnect() {
+    return disconnected.load(std::memory_order_relaxed) ||
+           failedReads > MaxFailedReads || failedWrites > MaxFailedWrites;
+  }
+  // Turns rumble off on every port.
+  void ResetRumble() {
+    desiredRumble.store(0, std::memory_order_relaxed);
+    rumbleRequested.store(true, std::memory_order_release);
+  }
+  // index: The controller port to assign the rumble value to.
+  // val: the rumble state to use. The following rumble bits are supported:
+  // 0b00000001: Enable rumble.
+  // 0b00000010: Enable motor braking.
+  // Both can (but should not) be used at the same time.
+  // Only records the desired state, so it never blocks. The transport sends
+  // the latest state of all four ports at most once per frame.
+  bool SetRumble(size_t index, unsigned char val) {
+    if (index >= 4) {
+      std::cout << "Rumble index out of range: " << index << std::endl;
+      return false;
+    }
+
+    // NOTE: Rumble should probably be disabled in the following circumstances,
+    // but it seems to not matter, so we ignore it for now:
+    // The controller is wireless. WaveBirds do not have rumble functionality.
+    // The grey USB cable is disconnected. Without it, there isn't enough power
+    // for the motors.
+    // The controller is disconnected. Rumble for detached controllers is
+    // pointless.
+
+    // Ports may be set from several notification threads at once.
+    const int shift = static_cast<int>(index) * 8;
+    uint32_t state = desiredRumble.load(std::memory_order_relaxed);
+    uint32_t updated;
+    do {
+      updated = (state & ~(0xFFu << shift)) | (uint32_t(val) << shift);
+    } while (!desiredRumble.compare_exchange_weak(state, updated,
+                                                  std::memory_order_relaxed));
+    rumbleRequested.store(true, std::memory_order_release);
+    return true;
+  }
+
+ protected:
+  // Timeout for each interrupt read. A healthy adapter reports at least every
+  // 8 ms, even with no controllers attached.
+  static const unsigned int ReadTimeoutMs = 16;
+  // Consecutive failed reads tolerated before the adapter is dropped.
+  static const size_t MaxFailedReads = 20;
+  // Consecutive payloads given up after all attempts, tolerated before the
+  // adapter is dropped.
+  static const size_t MaxFailedWrites = 2;
+
+  // Stamps a frame with the time its transfer completed and the next
+  // sequence number, and hands it to the input loop. Frames of one adapter
+  // must be published from one thread at a time.
+  void PublishInputs(const Inputs& inputs,
+                     std::chrono::steady_clock::time_point received =
+                         std::chrono::steady_clock::now()) {
+    const uint64_t previous =
+        stats.frames.fetch_add(1, std::memory_order_relaxed);
+    if (previous != 0) {
+      stats.frameInterval.Record(received - lastFrameTime);
+    }
+    lastFrameTime = received;
+    // Avoid dirtying the cache line on every frame.
+    if (failedReads.load(std::memory_order_relaxed) != 0) {
+      failedReads = 0;
+    }
+    const Frame frame{inputs, {received, previous + 1}};
+    if (recorder && Slot() != SIZE_MAX) {
+      recorder->RecordFrame(Slot(), frame.inputs.Controllers, frame.info);
+    }
+    latestFrame.Store(frame);
+    newInputs.Notify();
+  }
+  void RecordFailedRead() {
+    stats.failedReads.fetch_add(1, std::memory_order_relaxed);
+    failedReads++;
+    // Wake the input loop so it can notice a dying adapter promptly.
+    newInputs.Notify();
+  }
+  // A payload reached the adapter.
+  void RecordWrite() {
+    if (failedWrites.load(std::memory_order_relaxed) != 0) {
+      failedWrites = 0;
+    }
+  }
+  // A payload failed every attempt allowed by the write policy.
+  void RecordFailedWrite() {
+    stats.failedWrites.fetch_add(1, std::memory_order_relaxed);
+    failedWrites++;
+    newInputs.Notify();
+  }
+  // The adapter is gone. Fail fast instead of waiting out the timeouts.
+  // Permanent, unlike failed reads, which a late frame resets.
+  void RecordDisconnect() {
+    if (!disconnected.exchange(true) && recorder && Slot() != SIZE_MAX) {
+      recorder->RecordDisconnect(Slot());
+    }
+    newInputs.Notify();
+  }
+  // Called by the transport once per frame. Fills payload with the 0x11
+  // rumble payload for the latest requested state and returns true, unless
+  // nothing changed since the last payload taken. Requests made in between
+  // are coalesced. Must only be called from one thread at a time.
+  bool TakeRumblePayload(std::array<unsigned char, 5>& payload) {
+    if (!rumbleRequested.load(std::memory_order_relaxed) ||
+        !rumbleRequested.exchange(false, std::memory_order_acquire)) {
+      return false;
+    }
+    const uint32_t state = desiredRumble.load(std::memory_order_relaxed);
+    if (rumbleSent && state == sentRumble) {
+      return false;
+    }
+    rumbleSent = true;
+    sentRumble = state;
+    payload = {0x11, static_cast<unsigned char>(state),
+               static_cast<unsigned char>(state >> 8),
+               static_cast<unsigned char>(state >> 16),
+               static_cast<unsigned char>(state >> 24)};
+    if (recorder && Slot() != SIZE_MAX) {
+      recorder->RecordRumble(Slot(), payload);
+    }
+
+    if (DEBUG) {
+      std::cout << "Rumble payload: ";
+      for (const auto& val : payload) {
+        std::cout << "0x" << std::hex << static_cast<int>(val) << ", ";
+      }
+      std::cout << std::dec << std::endl;
+    }
+    return true;
+  }
+  // The payload last taken was not delivered. Makes the next
+  // TakeRumblePayload() send the latest state again.
+  void RetryRumble() {
+    rumbleSent = false;
+    rumbleRequested.store(true, std::memory_order_relaxed);
+  }
+  // Sends any pending rumble state through Write(), for transports whose
+  // writes are cheap enough to make synchronously once per frame.
+  bool FlushRumble() {
+    std::array<unsigned char, 5> payload;
+    if (!TakeRumblePayload(payload)) {
+      return true;
+    }
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    const bool written =
+        Write(payload.data(), static_cast<int>(payload.size()));
+    stats.rumbleWrite.Record(std::chrono::steady_clock::now() - start);
+    if (!written) {
+      RetryRumble();
+    }
+    return written;
+  }
+
+ private:
+  friend class AdapterManager;
+
+  // Set by AdapterManager.
+  std::atomic<size_t> slot = SIZE_MAX;
+  // The requested rumble value of each port, one byte per port.
+  std::atomic<uint32_t> desiredRumble = 0;
+  // Set by each request, cleared when the transport takes the state.
+  std::atomic<bool> rumbleRequested = false;
+  // The state last handed to the transport. Owned by the transport's thread.
+  bool rumbleSent = false;
+  uint32_t sentRumble = 0;
+
+  // The most recent frame, handed from the transport to the input loop
+  // without blocking either side.
+  LatestValueMailbox<Frame> latestFrame;
+  // Written by the consuming thread, on its own cache line. The mailbox
+  // sequence and the sequence number of the frame last consumed.
+  alignas(CacheLineSize) std::atomic<uint64_t> consumedSequence = 0;
+  uint64_t consumedFrame = 0;
+
+  std::atomic<size_t> failedReads = 0;
+  std::atomic<size_t> failedWrites = 0;
+  std::atomic<bool> disconnected = false;
+
+ protected:
+  AdapterStats stats;
+
+ private:
+  // When the previous frame was received. Owned by the publishing thread.
+  std::chrono::steady_clock::time_point lastFrameTime;
+};
+
+// The attached adapters, by slot. A slot keeps its index for as long as its
+// adapter is attached, and a freed slot is filled by the next adapter added.
+// Readers take no locks and touch no reference counts: they hold a ReadGuard
+// while using the raw pointers from Get(), and removed adapters are only
+// destroyed once every such reader has left. Adding and removing adapters
+// never allocates.
+class AdapterManager {
+ public:
+  static constexpr size_t MaxAdapters = 128;
+  // Input logs store slots in a byte.
+  static_assert(MaxAdapters <= 256);
+
+  // Keeps the adapters returned by Get() alive. Must not be held while adding
+  // or removing adapters.
+  using ReadGuard = EpochDomain<AdapterManager>::ReadGuard;
+
+  // Slots in use, including freed ones. Never shrinks, except by Clear().
+  static size_t Size() { return size.load(std::memory_order_acquire); }
+  // The adapter in a slot below Size(), or nullptr for a freed slot. Only
+  // valid while a ReadGuard is held.
+  static Adapter* Get(size_t slot) {
+    return slots[slot].load(std::memory_order_acquire);
+  }
+  // Changes whenever an adapter is added or removed.
+  static uint64_t Generation() {
+    return generation.load(std::memory_order_acquire);
+  }
+  // Shares ownership of the adapter in a slot, for use without a ReadGuard.
+  static std::shared_ptr<Adapter> Share(size_t slot) {
+    std::lock_guard<std::mutex> lock(writeMutex);
+    return owners[slot];
+  }
+
+  // Puts the adapter in the preferred slot if it is free, and otherwise in the
+  // first free one. Returns false if every slot is taken.
+  static bool AddAdapter(std::shared_ptr<Adapter> newAdapter,
+                         size_t preferredSlot = SIZE_MAX) {
+    size_t index;
+    {
+      std::lock_guard<std::mutex> lock(writeMutex);
+      size_t count = size.load(std::memory_order_relaxed);
+      if (preferredSlot < MaxAdapters && !owners[preferredSlot]) {
+        index = preferredSlot;
+        // Slots skipped over become stubs.
+        count = std::max(count, preferredSlot);
+      } else {
+        // Look for an existing empty stub (nullptr) to reuse.
+        index = std::find(owners.begin(), owners.begin() + count, nullptr) -
+                owners.begin();
+      }
+      if (index == MaxAdapters) {
+        std::cout << "Adapter limit of " << MaxAdapters << " reached"
+                  << std::endl;
+        return false;
+      }
+      owners[index] = std::move(newAdapter);
+      owners[index]->slot.store(index, std::memory_order_relaxed);
+      slots[index].store(owners[index].get(), std::memory_order_release);
+      // No stubs found, append to the end.
+      if (index == count) {
+        size.store(count + 1, std::memory_order_release);
+      }
+      generation.fetch_add(1, std::memory_order_release);
+    }
+    g_feederStats.adapterConnects.fetch_add(1, std::memory_order_relaxed);
+    std::cout << "Adapter " << index + 1 << " connected" << std::endl;
+    return true;
+  }
+
+  // Replaces the adapter with a stub, and destroys it once no reader can see
+  // it anymore.
+  static void RemoveAdapter(Adapter* target_raw_ptr) {
+    std::shared_ptr<Adapter> removed;
+    size_t index;
+    {
+      std::lock_guard<std::mutex> lock(writeMutex);
+      const size_t count = size.load(std::memory_order_relaxed);
+      // Find the adapter by raw pointer.
+      index = std::find_if(owners.begin(), owners.begin() + count,
+                           [target_raw_ptr](const auto& owner) {
+                             return owner && owner.get() == target_raw_ptr;
+                           }) -
+              owners.begin();
+      // Already removed or not found.
+      if (index == count) {
+        return;
+      }
+      slots[index].store(nullptr, std::memory_order_release);
+      removed = std::move(owners[index]);
+      generation.fetch_add(1, std::memory_order_release);
+    }
+    EpochDomain<AdapterManager>::Synchronize();
+    g_feederStats.adapterDisconnects.fetch_add(1, std::memory_order_relaxed);
+    std::cout << "Adapter " << index + 1 << " disconnected" << std::endl;
+  }
+
+  // Drops every adapter. Must run before the libusb context is torn down.
+  static void Clear() {
+    std::array<std::shared_ptr<Adapter>, MaxAdapters> removed;
+    {
+      std::lock_guard<std::mutex> lock(writeMutex);
+      const size_t count = size.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < count; i++) {
+        slots[i].store(nullptr, std::memory_order_release);
+        removed[i] = std::move(owners[i]);
+      }
+      size.store(0, std::memory_order_release);
+      generation.fetch_add(1, std::memory_order_release);
+    }
+    EpochDomain<AdapterManager>::Synchronize();
+  }
+
+ private:
+  // Serializes writers. Readers never take it.
+  static inline std::mutex writeMutex;
+  static inline std::array<std::atomic<Adapter*>, MaxAdapters> slots{};
+  // Owns the adapters in slots. Guarded by writeMutex.
+  static inline std::array<std::shared_ptr<Adapter>, MaxAdapters> owners;
+  static inline std::atomic<size_t> size = 0;
+  static inline std::atomic<uint64_t> generation = 0;
+};
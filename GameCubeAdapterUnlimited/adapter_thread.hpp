@@ -0,0 +1,252 @@
+#pragma once
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "adapter.hpp"
+#include "controller.hpp"
+#include "debug.hpp"
+#include "padsink.hpp"
+#include "stats.hpp"
+
+class AdapterThread {
+ public:
+  // Take a sink reference to share ownership.
+  AdapterThread(VirtualPadSink& sink) : sink(sink) {
+    sink.SetRumbleCallback(&AdapterThread::UpdateRumble, this);
+  }
+
+  void SetupPads() { ReservePads(AdapterManager::Size()); }
+
+  // Makes sure pads exist for the given number of adapters, so the port order
+  // is fixed before any adapter is attached.
+  void ReservePads(size_t numAdapters) {
+    if (sink.NumPads() / 4 >= numAdapters) {
+      return;
+    }
+    // Several workers may find new adapters at once.
+    std::lock_guard<std::mutex> lock(setupMutex);
+    const size_t numPads = sink.NumPads();
+    if (numPads / 4 >= numAdapters) {
+      return;
+    }
+    // Set up the virtual gamepads, all at once.
+    const size_t count = numAdapters * 4 - numPads;
+    const size_t first = sink.AddPads(count);
+    for (size_t pad = first; pad < first + count; pad++) {
+      // Initialize the inputs to nothing.
+      const Controller::GCInput resetGCInput;
+      sink.UpdatePad(pad, Controller::GCtoDS4(resetGCInput), FrameInfo());
+    }
+  }
+
+  // Publishes adapter inputs to the sink until Stop() is called. With several
+  // workers, run() starts the others and serves as the first one itself.
+  void run() {
+    std::vector<std::thread> workers;
+    for (size_t worker = 1; worker < numWorkers; worker++) {
+      workers.emplace_back([this, worker]() { RunWorker(worker); });
+    }
+    RunWorker(0);
+    for (std::thread& worker : workers) {
+      worker.join();
+    }
+    // Tear down gamepads when the loop is over.
+    for (size_t i = 0; i < sink.NumPads(); i++) {
+      sink.RemovePad(i);
+    }
+  }
+
+  // Makes run() return after its current pass.
+  void Stop() { stopRequested = true; }
+
+  // Forwards rumble requests from the sink to the adapter owning the pad.
+  static void UpdateRumble(void* /*context*/, size_t index,
+                           unsigned char largeMotor, unsigned char smallMotor) {
+    AdapterManager::ReadGuard guard;
+    size_t adapterIndex = index / 4;
+    if (adapterIndex < AdapterManager::Size()) {
+      Adapter* adapter = AdapterManager::Get(adapterIndex);
+      if (adapter) {
+        bool motor = smallMotor || largeMotor;
+        adapter->SetRumble(index % 4, motor);
+      }
+    }
+  }
+
+  std::atomic<bool> stopRequested = false;
+  // The virtual gamepad sink. Shared between adapters.
+  VirtualPadSink& sink;
+  // How often an unchanged pad state is re-sent anyway.
+  std::chrono::milliseconds keepAliveInterval{1000};
+  // Threads publishing inputs. Worker w serves every adapter whose index is w
+  // modulo numWorkers, so a slow sink call for one adapter does not delay the
+  // others, and many adapters can use several cores. Set before run().
+  size_t numWorkers = 1;
+
+ private:
+  struct PadState {
+    // The controller connection state from the previous loop.
+    // Used to detect connection status changes.
+    bool isConnected = false;
+    // The inputs last sent to the sink, if any.
+    bool sent = false;
+    Controller::GCInput lastSent;
+    std::chrono::steady_clock::time_point lastSentTime;
+  };
+
+  // Sends a pad's inputs to the sink, unless they match what was last sent and
+  // the keep-alive interval has not elapsed yet. Idle controllers then cost no
+  // sink calls between keep-alives. Returns whether the sink was updated.
+  bool SendInputs(PadState& pad, size_t index, const Controller::GCInput& input,
+                  const DS4_REPORT& report, const FrameInfo& frame,
+                  std::chrono::steady_clock::time_point now) {
+    if (pad.sent && Controller::SameInputs(input, pad.lastSent) &&
+        now - pad.lastSentTime < keepAliveInterval) {
+      return false;
+    }
+    const std::chrono::steady_clock::time_point start =
+        std::chrono::steady_clock::now();
+    sink.UpdatePad(index, report, frame);
+    g_feederStats.sinkUpdate.Record(std::chrono::steady_clock::now() - start);
+    pad.sent = true;
+    pad.lastSent = input;
+    pad.lastSentTime = now;
+    return true;
+  }
+
+  void RunWorker(size_t worker) {
+    // Indexed by the sink's pad indices. Each worker only touches the pads of
+    // its own adapters.
+    std::vector<PadState> padStates;
+    // Adapters to remove once the pass that found them is over, since
+    // removal waits for every reader, including this one, to leave.
+    std::vector<Adapter*> lostAdapters;
+    lostAdapters.reserve(AdapterManager::MaxAdapters);
+    uint64_t lastFrame = 0;
+    uint64_t generation = 0;
+    while (!stopRequested) {
+      for (Adapter* adapter : lostAdapters) {
+        AdapterManager::RemoveAdapter(adapter);
+      }
+      lostAdapters.clear();
+      // Sleep until any adapter publishes a frame. The timeout keeps shutdown
+      // and pad allocation responsive while no adapters are attached.
+      lastFrame =
+          Adapter::newInputs.Wait(lastFrame, std::chrono::milliseconds(100));
+      // Allocate new virtual pads as needed.
+      if (AdapterManager::Generation() != generation) {
+        generation = AdapterManager::Generation();
+        SetupPads();
+      }
+      const std::chrono::steady_clock::time_point now =
+          std::chrono::steady_clock::now();
+
+      AdapterManager::ReadGuard guard;
+      // Adapters added since the pads were set up wait for the next pass.
+      const size_t numAdapters =
+          std::min(AdapterManager::Size(), sink.NumPads() / 4);
+      if (padStates.size() < numAdapters * 4) {
+        padStates.resize(numAdapters * 4);
+      }
+      // Read inputs and update virtual gamepads.
+      for (size_t i = worker; i < numAdapters; i += numWorkers) {
+        Adapter* currentAdapter = AdapterManager::Get(i);
+        // Missing adapters are skipped.
+        if (!currentAdapter) {
+          continue;
+        }
+        // If reads keep failing, remove the lost adapter.
+        if (currentAdapter->ShouldDisconnect()) {
+          lostAdapters.push_back(currentAdapter);
+          // Associated pads are marked as disconnected.
+          // NOTE: This assumes inputs.Controllers[j].On() remains true.
+          for (size_t j = 0; j < 4; j++) {
+            size_t index = i * 4 + j;
+            padStates[index].isConnected = false;
+          }
+          continue;
+        }
+        // Only adapters that published a frame since the last pass update
+        // their virtual gamepads.
+        Adapter::Frame frame;
+        if (!currentAdapter->GetFrame(frame)) {
+          continue;
+        }
+        Adapter::Inputs& inputs = frame.inputs;
+        // Only the first report delivered from a frame counts towards the
+        // input latency.
+        bool delivered = false;
+        // Convert the whole frame at once.
+        DS4_REPORT reports[4];
+        Controller::GCtoDS4(inputs.Controllers, reports, 4);
+        // Update the inputs of each virtual gamepad.
+        for (size_t j = 0; j < 4; j++) {
+          const size_t index = i * 4 + j;
+          Controller::GCInput& input = inputs.Controllers[j];
+          // Check for a connection change.
+          bool& isConnected = padStates[index].isConnected;
+          if (isConnected != (bool)input.On()) {
+            isConnected = (bool)input.On();
+            if (isConnected) {
+              std::cout << "Controller " << index + 1 << " connected";
+              if (DEBUG) {
+                std::cout << " (" << std::bitset<8>(input.Status) << ")"
+                          << std::endl
+                          << "Wireless: "
+                          << (input.Wireless ? "Wireless" : "Wired")
+                          << std::endl
+                          << "Wireless Receive: "
+                          << (input.WirelessReceive ? "Yes" : "No") << std::endl
+                          << "Can Rumble: " << (input.CanRumble ? "Yes" : "No")
+                          << std::endl
+                          << "Console: " << (input.Console ? "GameCube" : "N64")
+                          << std::endl
+                          << "Wireless Type: "
+                          << (input.WirelessType ? "RF" : "IF") << std::endl
+                          << "Wireless State: "
+                          << (input.WirelessState ? "Fixed" : "Variable")
+                          << std::endl
+                          << "Standard: "
+                          << (input.Standard ? "Standard" : "Non-standard")
+                          << std::endl;
+              }
+              std::cout << std::endl;
+            } else {
+              // Disconnected controllers are reset.
+              const Controller::GCInput resetGCInput;
+              SendInputs(padStates[index], index, resetGCInput,
+                         Controller::GCtoDS4(resetGCInput), frame.info, now);
+              std::cout << "Controller " << index + 1 << " disconnected"
+                        << std::endl;
+            }
+          }
+          if (!input.On()) {
+            continue;
+          }
+          if (sink.NumPads() <= index) {
+            throw std::out_of_range(
+                "Not enough virtual pads allocated to handle adapter inputs.");
+          }
+          if (SendInputs(padStates[index], index, input, reports[j],
+                         frame.info, now) &&
+              !delivered) {
+            delivered = true;
+            g_feederStats.inputLatency.Record(std::chrono::steady_clock::now() -
+                                              frame.info.received);
+          }
+        }
+      }
+    }
+  }
+
+  // Serializes pad allocation between workers.
+  std::mutex setupMutex;
+};
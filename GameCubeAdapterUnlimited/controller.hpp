@@ -0,0 +1,292 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstring>
+
+#include "ds4_report.hpp"
+
+// The batch conversion needs a byte shuffle, which SSE2 lacks. SSSE3 is part of
+// every AVX2 target.
+#if defined(__AVX2__) || defined(__SSSE3__)
+#include <tmmintrin.h>
+#define GCADAPTER_SIMD_CONVERSION 1
+#endif
+
+// Maps a 12-bit GameCube button word to the DS4 buttons and D-pad hat,
+// following Controller::GCtoDS4Reference().
+constexpr USHORT GCButtonsToDS4(unsigned int gc) {
+  auto pressed = [gc](int bit) { return (gc >> bit) & 1; };
+  const unsigned int a = pressed(0), b = pressed(1), x = pressed(2),
+                     y = pressed(3), left = pressed(4), right = pressed(5),
+                     down = pressed(6), up = pressed(7), start = pressed(8),
+                     z = pressed(9), r = pressed(10), l = pressed(11);
+  unsigned int ds4 = 0;
+  if (start) ds4 |= DS4_BUTTON_OPTIONS;
+  if (z) ds4 |= DS4_BUTTON_SHARE;
+  if (r) ds4 |= DS4_BUTTON_SHOULDER_RIGHT;
+  if (l) ds4 |= DS4_BUTTON_SHOULDER_LEFT;
+  if (x) ds4 |= DS4_BUTTON_TRIANGLE;
+  if (a) ds4 |= DS4_BUTTON_CIRCLE;
+  if (b) ds4 |= DS4_BUTTON_CROSS;
+  if (y) ds4 |= DS4_BUTTON_SQUARE;
+
+  if (up && left)
+    ds4 |= DS4_BUTTON_DPAD_NORTHWEST;
+  else if (down && left)
+    ds4 |= DS4_BUTTON_DPAD_SOUTHWEST;
+  else if (down && right)
+    ds4 |= DS4_BUTTON_DPAD_SOUTHEAST;
+  else if (up && right)
+    ds4 |= DS4_BUTTON_DPAD_NORTHEAST;
+  else if (up)
+    ds4 |= DS4_BUTTON_DPAD_NORTH;
+  else if (left)
+    ds4 |= DS4_BUTTON_DPAD_WEST;
+  else if (down)
+    ds4 |= DS4_BUTTON_DPAD_SOUTH;
+  else if (right)
+    ds4 |= DS4_BUTTON_DPAD_EAST;
+  else
+    ds4 |= DS4_BUTTON_DPAD_NONE;
+  return static_cast<USHORT>(ds4);
+}
+constexpr std::array<USHORT, 4096> MakeGCButtonTable() {
+  std::array<USHORT, 4096> table{};
+  for (unsigned int gc = 0; gc < table.size(); gc++) {
+    table[gc] = GCButtonsToDS4(gc);
+  }
+  return table;
+}
+
+struct Controller {
+#pragma pack(push, 1)
+  struct GCInput {
+    union {
+      // Status bits layout: https://hitmen.c02.at/files/yagcd/yagcd/chap9.html
+      unsigned char Status;
+      struct {
+        // Wireless (1: wireless Controller)
+        unsigned char Wireless : 1;
+        // Wireless receive (0: not wireless 1: wireless)
+        unsigned char WirelessReceive : 1;
+        // This bit is set when the grey USB cable is attached, to power rumble.
+        unsigned char CanRumble : 1;
+        // Seemingly always 0.
+        unsigned char _pad : 1;
+        // Controller type (0: N64, 1: GameCube)
+        unsigned char Console : 1;
+        // Wireless type (0:IF 1:RF)
+        unsigned char WirelessType : 1;
+        // Wireless state (0: variable 1: fixed)
+        unsigned char WirelessState : 1;
+        // 0: Non-standard controller, 1: Standard GameCube controller
+        unsigned char Standard : 1;
+      };
+    };
+    union {
+      unsigned short Buttons;
+      struct {
+        unsigned short A : 1;
+        unsigned short B : 1;
+        unsigned short X : 1;
+        unsigned short Y : 1;
+        unsigned short DpadLeft : 1;
+        unsigned short DpadRight : 1;
+        unsigned short DpadDown : 1;
+        unsigned short DpadUp : 1;
+        unsigned short Start : 1;
+        unsigned short Z : 1;
+        unsigned short R : 1;
+        unsigned short L : 1;
+      };
+    };
+    unsigned char AnalogX;
+    unsigned char AnalogY;
+    unsigned char CStickX;
+    unsigned char CStickY;
+    unsigned char LeftTrigger;
+    unsigned char RightTrigger;
+
+    GCInput()
+        : Status(0),
+          Buttons(0),
+          AnalogX(128),
+          AnalogY(128),
+          CStickX(128),
+          CStickY(128),
+          LeftTrigger(0),
+          RightTrigger(0) {};
+    // NOTE: This bit is always 1 when a GameCube controller is attached.
+    bool On() { return Console; }
+  };
+#pragma pack(pop)
+
+  // Whether two inputs produce the same report. The Status byte is ignored.
+  static bool SameInputs(const GCInput& a, const GCInput& b) {
+    return a.Buttons == b.Buttons && a.AnalogX == b.AnalogX &&
+           a.AnalogY == b.AnalogY && a.CStickX == b.CStickX &&
+           a.CStickY == b.CStickY && a.LeftTrigger == b.LeftTrigger &&
+           a.RightTrigger == b.RightTrigger;
+  }
+
+  static _DS4_REPORT GCtoDS4(const GCInput& gc) {
+    _DS4_REPORT ds4{};
+    ds4.bThumbLX = gc.AnalogX;
+    ds4.bThumbLY = ~gc.AnalogY;
+    ds4.bThumbRX = gc.CStickX;
+    ds4.bThumbRY = ~gc.CStickY;
+    ds4.wButtons = ButtonTable[gc.Buttons & ButtonMask];
+    ds4.bTriggerL = gc.LeftTrigger;
+    ds4.bTriggerR = gc.RightTrigger;
+    return ds4;
+  }
+
+  // Converts count controllers at once. Groups of 4, such as the controllers
+  // of one adapter frame, use SIMD where available.
+  static void GCtoDS4(const GCInput* gc, _DS4_REPORT* ds4, size_t count) {
+    size_t i = 0;
+#ifdef GCADAPTER_SIMD_CONVERSION
+    for (; i + 4 <= count; i += 4) {
+      GCtoDS4x4(gc + i, ds4 + i);
+    }
+#endif
+    for (; i < count; i++) {
+      ds4[i] = GCtoDS4(gc[i]);
+    }
+  }
+
+  // Checks the table-driven and batch conversions against GCtoDS4Reference()
+  // for every button state.
+  static bool VerifyConversion() {
+    auto same = [](const _DS4_REPORT& a, const _DS4_REPORT& b) {
+      return a.bThumbLX == b.bThumbLX && a.bThumbLY == b.bThumbLY &&
+             a.bThumbRX == b.bThumbRX && a.bThumbRY == b.bThumbRY &&
+             a.wButtons == b.wButtons && a.bSpecial == b.bSpecial &&
+             a.bTriggerL == b.bTriggerL && a.bTriggerR == b.bTriggerR;
+    };
+    for (unsigned int buttons = 0; buttons <= ButtonMask; buttons += 4) {
+      GCInput gc[4];
+      _DS4_REPORT batch[4];
+      for (unsigned int j = 0; j < 4; j++) {
+        gc[j].Status = static_cast<unsigned char>(buttons * 7 + j);
+        gc[j].Buttons = static_cast<unsigned short>(buttons + j);
+        gc[j].AnalogX = static_cast<unsigned char>(buttons + j);
+        gc[j].AnalogY = static_cast<unsigned char>(buttons >> 4);
+        gc[j].CStickX = static_cast<unsigned char>(~buttons);
+        gc[j].CStickY = static_cast<unsigned char>(buttons * 3 + j);
+        gc[j].LeftTrigger = static_cast<unsigned char>(buttons * 5);
+        gc[j].RightTrigger = static_cast<unsigned char>(j * 64);
+      }
+      GCtoDS4(gc, batch, 4);
+      for (unsigned int j = 0; j < 4; j++) {
+        const _DS4_REPORT expected = GCtoDS4Reference(gc[j]);
+        if (!same(GCtoDS4(gc[j]), expected) || !same(batch[j], expected)) {
+          return false;
+        }
+      }
+    }
+    return true;
+  }
+
+  // The original bitfield-based conversion. Only used to verify the others.
+  static _DS4_REPORT GCtoDS4Reference(const GCInput& gc) {
+    _DS4_REPORT ds4{};
+
+    ds4.bThumbLX = gc.AnalogX;
+    ds4.bThumbLY = ~gc.AnalogY;
+    ds4.bThumbRX = gc.CStickX;
+    ds4.bThumbRY = ~gc.CStickY;
+
+    ds4.wButtons = 0;
+    if (gc.Start) ds4.wButtons |= DS4_BUTTON_OPTIONS;
+    if (gc.Z) ds4.wButtons |= DS4_BUTTON_SHARE;
+    if (gc.R) ds4.wButtons |= DS4_BUTTON_SHOULDER_RIGHT;
+    if (gc.L) ds4.wButtons |= DS4_BUTTON_SHOULDER_LEFT;
+    if (gc.X) ds4.wButtons |= DS4_BUTTON_TRIANGLE;
+    if (gc.A) ds4.wButtons |= DS4_BUTTON_CIRCLE;
+    if (gc.B) ds4.wButtons |= DS4_BUTTON_CROSS;
+    if (gc.Y) ds4.wButtons |= DS4_BUTTON_SQUARE;
+
+    if (gc.DpadUp && gc.DpadLeft)
+      ds4.wButtons |= DS4_BUTTON_DPAD_NORTHWEST;
+    else if (gc.DpadDown && gc.DpadLeft)
+      ds4.wButtons |= DS4_BUTTON_DPAD_SOUTHWEST;
+    else if (gc.DpadDown && gc.DpadRight)
+      ds4.wButtons |= DS4_BUTTON_DPAD_SOUTHEAST;
+    else if (gc.DpadUp && gc.DpadRight)
+      ds4.wButtons |= DS4_BUTTON_DPAD_NORTHEAST;
+    else if (gc.DpadUp)
+      ds4.wButtons |= DS4_BUTTON_DPAD_NORTH;
+    else if (gc.DpadLeft)
+      ds4.wButtons |= DS4_BUTTON_DPAD_WEST;
+    else if (gc.DpadDown)
+      ds4.wButtons |= DS4_BUTTON_DPAD_SOUTH;
+    else if (gc.DpadRight)
+      ds4.wButtons |= DS4_BUTTON_DPAD_EAST;
+    else
+      ds4.wButtons |= DS4_BUTTON_DPAD_NONE;
+
+    ds4.bTriggerL = gc.LeftTrigger;
+    ds4.bTriggerR = gc.RightTrigger;
+
+    return ds4;
+  }
+
+ private:
+  // GameCube buttons use the low 12 bits of the button word.
+  static constexpr unsigned short ButtonMask = 0x0FFF;
+
+  static constexpr std::array<USHORT, ButtonMask + 1> ButtonTable =
+      MakeGCButtonTable();
+
+#ifdef GCADAPTER_SIMD_CONVERSION
+  // Converts 4 consecutive controllers (36 bytes) into 4 reports (40 bytes)
+  // with three shuffles. Y axes are inverted with an XOR, and the button words
+  // are then filled in from the table.
+  static void GCtoDS4x4(const GCInput* gc, _DS4_REPORT* ds4) {
+    static_assert(sizeof(GCInput) == 9 && sizeof(_DS4_REPORT) == 10);
+    static_assert(offsetof(_DS4_REPORT, wButtons) == 4);
+    static_assert(offsetof(_DS4_REPORT, bTriggerL) == 7);
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(gc);
+    unsigned char* out = reinterpret_cast<unsigned char*>(ds4);
+
+    // Output bytes 0-15, from input bytes 3-18. -1 clears a byte.
+    const __m128i low = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 3)),
+        _mm_setr_epi8(0, 1, 2, 3, -1, -1, -1, 4, 5, -1, 9, 10, 11, 12, -1, -1));
+    // Output bytes 16-31, from input bytes 16-31.
+    const __m128i middle = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 16)),
+        _mm_setr_epi8(-1, 0, 1, -1, 5, 6, 7, 8, -1, -1, -1, 9, 10, -1, 14, 15));
+    // Output bytes 32-39, from input bytes 20-35.
+    const __m128i high = _mm_shuffle_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + 20)),
+        _mm_setr_epi8(12, 13, -1, -1, -1, 14, 15, -1, -1, -1, -1, -1, -1, -1,
+                      -1, -1));
+    // Inverts bThumbLY and bThumbRY.
+    __m128i outLow = _mm_xor_si128(
+        low, _mm_setr_epi8(0, -1, 0, -1, 0, 0, 0, 0, 0, 0, 0, -1, 0, -1, 0, 0));
+    __m128i outMiddle = _mm_xor_si128(
+        middle,
+        _mm_setr_epi8(0, 0, 0, 0, 0, -1, 0, -1, 0, 0, 0, 0, 0, 0, 0, -1));
+    __m128i outHigh = _mm_xor_si128(
+        high, _mm_setr_epi8(0, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0));
+
+    // Each report's wButtons is a 16-bit lane of one of the outputs.
+    unsigned short buttons[4];
+    for (size_t i = 0; i < 4; i++) {
+      memcpy(&buttons[i], in + i * sizeof(GCInput) + 1, sizeof(buttons[i]));
+    }
+    outLow = _mm_insert_epi16(outLow, ButtonTable[buttons[0] & ButtonMask], 2);
+    outLow = _mm_insert_epi16(outLow, ButtonTable[buttons[1] & ButtonMask], 7);
+    outMiddle =
+        _mm_insert_epi16(outMiddle, ButtonTable[buttons[2] & ButtonMask], 4);
+    outHigh =
+        _mm_insert_epi16(outHigh, ButtonTable[buttons[3] & ButtonMask], 1);
+
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), outLow);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 16), outMiddle);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out + 32), outHigh);
+  }
+#endif
+};
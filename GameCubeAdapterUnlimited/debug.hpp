@@ -0,0 +1,4 @@
+#pragma once
+
+// Enables verbose logging.
+constexpr bool DEBUG = false;
@@ -0,0 +1,23 @@
+#pragma once
+// Makes the ViGEm DS4_REPORT definitions available on every platform, so all
+// virtual pad sinks share the same report type.
+#ifdef _WIN32
+#include <windows.h>
+// Windows header must be defined before these to prevent build errors.
+#include <ViGEm/Common.h>
+#else
+#include <cstring>
+
+// The subset of Win32 types and annotations used by ViGEm/Common.h.
+typedef unsigned char BYTE;
+typedef unsigned char UCHAR;
+typedef short SHORT;
+typedef unsigned short USHORT;
+#define VOID void
+#define FORCEINLINE inline
+#define _In_
+#define _Out_
+#define RtlZeroMemory(Destination, Length) memset((Destination), 0, (Length))
+
+#include <ViGEm/Common.h>
+#endif
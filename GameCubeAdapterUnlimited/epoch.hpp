@@ -0,0 +1,125 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+
+#include "mailbox.hpp"
+
+// Epoch-based reclamation, for shared data that readers access through plain
+// atomic loads, without locks or reference counts.
+//
+// Readers pin the current epoch for the lifetime of a ReadGuard. A writer that
+// unlinks an object calls Synchronize(), which returns once every reader that
+// might still hold a pointer to it has left, after which the object can be
+// destroyed. Each Tag type gets its own set of readers.
+template <typename Tag>
+class EpochDomain {
+ public:
+  // Threads that can read at the same time. A thread claims a slot on its
+  // first read and releases it when it exits.
+  static constexpr size_t MaxReaders = 1024;
+
+  // Keeps everything reachable at construction alive until destruction.
+  // Nests, and must not be held across a Synchronize() on the same thread.
+  class ReadGuard {
+   public:
+    ReadGuard() { Enter(); }
+    ~ReadGuard() { Leave(); }
+    ReadGuard(const ReadGuard&) = delete;
+    ReadGuard& operator=(const ReadGuard&) = delete;
+  };
+
+  // Whether the calling thread holds a ReadGuard.
+  static bool IsReading() { return local.depth > 0; }
+
+  // Waits until every reader that was pinned before the call has left.
+  // Objects unlinked before the call are then unreachable.
+  static void Synchronize() {
+    if (IsReading()) {
+      throw std::runtime_error(
+          "EpochDomain::Synchronize() called while holding a ReadGuard");
+    }
+    const uint64_t retired = epoch.fetch_add(1, std::memory_order_seq_cst);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    const size_t numSlots = usedSlots.load(std::memory_order_acquire);
+    for (size_t i = 0; i < numSlots; i++) {
+      while (true) {
+        const uint64_t pinned =
+            readers[i].epoch.load(std::memory_order_acquire);
+        // Idle, or pinned after the epoch advanced.
+        if (pinned == 0 || pinned > retired) {
+          break;
+        }
+        std::this_thread::yield();
+      }
+    }
+  }
+
+ private:
+  struct alignas(CacheLineSize) ReaderSlot {
+    // The epoch pinned by the owning thread, or 0 while it is not reading.
+    std::atomic<uint64_t> epoch = 0;
+    std::atomic<bool> claimed = false;
+  };
+
+  // The calling thread's slot, released when the thread exits.
+  struct ThreadState {
+    ReaderSlot* slot = nullptr;
+    int depth = 0;
+    ~ThreadState() {
+      if (slot) {
+        slot->epoch.store(0, std::memory_order_release);
+        slot->claimed.store(false, std::memory_order_release);
+      }
+    }
+  };
+
+  static ReaderSlot& Claim() {
+    for (size_t i = 0; i < MaxReaders; i++) {
+      ReaderSlot& reader = readers[i];
+      bool expected = false;
+      if (!reader.claimed.load(std::memory_order_relaxed) &&
+          reader.claimed.compare_exchange_strong(expected, true,
+                                                 std::memory_order_acquire)) {
+        size_t used = usedSlots.load(std::memory_order_relaxed);
+        while (used <= i && !usedSlots.compare_exchange_weak(
+                                used, i + 1, std::memory_order_release)) {
+        }
+        return reader;
+      }
+    }
+    throw std::runtime_error("EpochDomain has no free reader slots");
+  }
+
+  static void Enter() {
+    ThreadState& state = local;
+    if (state.depth++ > 0) {
+      return;
+    }
+    if (!state.slot) {
+      state.slot = &Claim();
+    }
+    state.slot->epoch.store(epoch.load(std::memory_order_acquire),
+                            std::memory_order_relaxed);
+    // Pairs with the fence in Synchronize(): either the writer sees the pin,
+    // or the reader sees the unlinked pointer.
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+  }
+  static void Leave() {
+    ThreadState& state = local;
+    if (--state.depth > 0) {
+      return;
+    }
+    state.slot->epoch.store(0, std::memory_order_release);
+  }
+
+  // Starts at 1, so that 0 can mean a reader is idle.
+  static inline std::atomic<uint64_t> epoch = 1;
+  static inline std::array<ReaderSlot, MaxReaders> readers{};
+  // Slots ever claimed, so Synchronize() only scans those.
+  static inline std::atomic<size_t> usedSlots = 0;
+  static inline thread_local ThreadState local;
+};
@@ -0,0 +1,13 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+
+// Identifies the adapter frame a report was made from.
+struct FrameInfo {
+  // When the frame's transfer completed, on the monotonic clock.
+  std::chrono::steady_clock::time_point received;
+  // Counts the adapter's frames from 1. Consecutive frames differ by one, so
+  // a gap means frames were superseded before they were used. 0 for reports
+  // that no frame caused.
+  uint64_t sequence = 0;
+};
@@ -0,0 +1,275 @@
+#include "input_log.hpp"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace {
+
+// Identifies an input log, in the data of its header record.
+const char Magic[] = "GCAU input log 1";
+
+}  // namespace
+
+InputRecorder::InputRecorder(const std::string& path)
+    : startTime(std::chrono::steady_clock::now()) {
+#ifdef _WIN32
+  HANDLE handle =
+      CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ,
+                  nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (handle == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error("Failed to create " + path);
+  }
+  file = handle;
+#else
+  fd = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to create " + path);
+  }
+#endif
+  InputLogRecord* header = MapSegment(0);
+  if (!header) {
+    CloseFile();
+    throw std::runtime_error("Failed to map " + path);
+  }
+  header->type = InputLogRecord::Header;
+  memcpy(header->data, Magic, sizeof(Magic) - 1);
+  growThread = std::thread([this]() { Grow(); });
+}
+
+InputRecorder::~InputRecorder() {
+  {
+    std::lock_guard<std::mutex> lock(growMutex);
+    stopping = true;
+  }
+  stopGrowing.notify_all();
+  growThread.join();
+
+  // Claimed records past the mapped segments were dropped, not written.
+  uint64_t records = next.load(std::memory_order_relaxed);
+  size_t mapped = 0;
+  for (std::atomic<InputLogRecord*>& segment : segments) {
+    InputLogRecord* view = segment.load(std::memory_order_relaxed);
+    if (!view) {
+      break;
+    }
+    mapped++;
+#ifdef _WIN32
+    UnmapViewOfFile(view);
+#else
+    munmap(view, SegmentBytes);
+#endif
+  }
+  records = std::min<uint64_t>(records, mapped * SegmentRecords);
+  const uint64_t bytes = records * sizeof(InputLogRecord);
+#ifdef _WIN32
+  LARGE_INTEGER size;
+  size.QuadPart = static_cast<LONGLONG>(bytes);
+  SetFilePointerEx(file, size, nullptr, FILE_BEGIN);
+  SetEndOfFile(file);
+#else
+  if (ftruncate(fd, static_cast<off_t>(bytes)) != 0) {
+    std::cout << "Failed to trim the input log" << std::endl;
+  }
+#endif
+  CloseFile();
+}
+
+void InputRecorder::CloseFile() {
+#ifdef _WIN32
+  CloseHandle(file);
+#else
+  close(fd);
+#endif
+}
+
+void InputRecorder::RecordFrame(size_t slot,
+                                const Controller::GCInput (&controllers)[4],
+                                const FrameInfo& frame) {
+  InputLogRecord* record = Append(InputLogRecord::Frame, slot, frame.received);
+  if (record) {
+    record->sequence = static_cast<uint16_t>(frame.sequence);
+    memcpy(record->data, controllers, sizeof(record->data));
+  }
+}
+
+void InputRecorder::RecordRumble(size_t slot,
+                                 const std::array<unsigned char, 5>& payload) {
+  InputLogRecord* record = Append(InputLogRecord::Rumble, slot,
+                                  std::chrono::steady_clock::now());
+  if (record) {
+    // Skip the 0x11 command byte.
+    memcpy(record->data, payload.data() + 1, payload.size() - 1);
+  }
+}
+
+void InputRecorder::RecordDisconnect(size_t slot) {
+  Append(InputLogRecord::Disconnect, slot, std::chrono::steady_clock::now());
+}
+
+uint64_t InputRecorder::Records() const {
+  return next.load(std::memory_order_relaxed) - 1 - Dropped();
+}
+
+InputLogRecord* InputRecorder::Append(
+    uint8_t type, size_t slot, std::chrono::steady_clock::time_point time) {
+  const uint64_t index = next.fetch_add(1, std::memory_order_relaxed);
+  const size_t segment = static_cast<size_t>(index / SegmentRecords);
+  const size_t offset = static_cast<size_t>(index % SegmentRecords);
+  InputLogRecord* records =
+      segment < MaxSegments ? segments[segment].load(std::memory_order_acquire)
+                            : nullptr;
+  // The grow thread fell behind, or the file could not grow.
+  if (!records) {
+    dropped.fetch_add(1, std::memory_order_relaxed);
+    return nullptr;
+  }
+  InputLogRecord& record = records[offset];
+  record.timeNs = static_cast<uint64_t>(std::max<int64_t>(
+      0, std::chrono::duration_cast<std::chrono::nanoseconds>(time - startTime)
+             .count()));
+  record.slot = static_cast<uint8_t>(slot);
+  record.type = type;
+  return &record;
+}
+
+void InputRecorder::Grow() {
+  std::unique_lock<std::mutex> lock(growMutex);
+  while (!stopping && !growFailed) {
+    const size_t current = static_cast<size_t>(
+        next.load(std::memory_order_relaxed) / SegmentRecords);
+    const size_t last = std::min(current + SegmentsAhead, MaxSegments - 1);
+    for (size_t segment = current; segment <= last && !growFailed;
+         segment++) {
+      MapSegment(segment);
+    }
+    stopGrowing.wait_for(lock, GrowInterval, [this] { return stopping; });
+  }
+}
+
+InputLogRecord* InputRecorder::MapSegment(size_t segment) {
+  InputLogRecord* records = segments[segment].load(std::memory_order_relaxed);
+  if (records || growFailed) {
+    return records;
+  }
+  const uint64_t offset = uint64_t(segment) * SegmentBytes;
+  void* view = nullptr;
+#ifdef _WIN32
+  const uint64_t end = offset + SegmentBytes;
+  // Allocate the clusters now, so first writes to the pages do not wait for
+  // the file system. Creating a mapping larger than the file then grows the
+  // file, zero-filled.
+  FILE_ALLOCATION_INFO allocation{};
+  allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(end);
+  SetFileInformationByHandle(file, FileAllocationInfo, &allocation,
+                             sizeof(allocation));
+  HANDLE mapping =
+      CreateFileMappingA(file, nullptr, PAGE_READWRITE,
+                         static_cast<DWORD>(end >> 32),
+                         static_cast<DWORD>(end), nullptr);
+  if (mapping) {
+    view = MapViewOfFile(mapping, FILE_MAP_WRITE,
+                         static_cast<DWORD>(offset >> 32),
+                         static_cast<DWORD>(offset), SegmentBytes);
+    // The view keeps the mapping alive.
+    CloseHandle(mapping);
+  }
+#else
+  // Unlike ftruncate, which leaves a sparse file, this allocates the blocks,
+  // so first writes to the pages do not wait for the file system.
+  if (posix_fallocate(fd, static_cast<off_t>(offset),
+                      static_cast<off_t>(SegmentBytes)) == 0) {
+    view = mmap(nullptr, SegmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+                static_cast<off_t>(offset));
+    if (view == MAP_FAILED) {
+      view = nullptr;
+    }
+  }
+#endif
+  if (!view) {
+    std::cout << "Failed to grow the input log, recording stopped"
+              << std::endl;
+    growFailed = true;
+    return nullptr;
+  }
+  records = static_cast<InputLogRecord*>(view);
+  segments[segment].store(records, std::memory_order_release);
+  return records;
+}
+
+InputLogReader::InputLogReader(const std::string& path) {
+  const void* view = nullptr;
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                            nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    throw std::runtime_error("Failed to open " + path);
+  }
+  LARGE_INTEGER fileSize{};
+  GetFileSizeEx(file, &fileSize);
+  mappedBytes = static_cast<size_t>(fileSize.QuadPart);
+  if (mappedBytes > 0) {
+    HANDLE mapping =
+        CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping) {
+      view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      CloseHandle(mapping);
+    }
+  }
+  CloseHandle(file);
+#else
+  const int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    throw std::runtime_error("Failed to open " + path);
+  }
+  struct stat info {};
+  fstat(fd, &info);
+  mappedBytes = static_cast<size_t>(info.st_size);
+  if (mappedBytes > 0) {
+    view = mmap(nullptr, mappedBytes, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (view == MAP_FAILED) {
+      view = nullptr;
+    } else {
+      // Replay reads front to back.
+      posix_madvise(const_cast<void*>(view), mappedBytes,
+                    POSIX_MADV_SEQUENTIAL);
+    }
+  }
+  close(fd);
+#endif
+  if (!view) {
+    throw std::runtime_error("Failed to map " + path);
+  }
+  records = static_cast<const InputLogRecord*>(view);
+  size = mappedBytes / sizeof(InputLogRecord);
+  if (size == 0 || records[0].type != InputLogRecord::Header ||
+      memcmp(records[0].data, Magic, sizeof(Magic) - 1) != 0) {
+    Unmap();
+    throw std::runtime_error(path + " is not an input log");
+  }
+}
+
+InputLogReader::~InputLogReader() { Unmap(); }
+
+void InputLogReader::Unmap() {
+  if (!records) {
+    return;
+  }
+#ifdef _WIN32
+  UnmapViewOfFile(records);
+#else
+  munmap(const_cast<InputLogRecord*>(records), mappedBytes);
+#endif
+  records = nullptr;
+}
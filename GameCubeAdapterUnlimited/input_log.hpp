@@ -0,0 +1,135 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "controller.hpp"
+#include "frame_info.hpp"
+
+// One entry of an input log: a binary file of fixed-size records, written by
+// InputRecorder and read back by InputLogReader. The first record is a header.
+struct InputLogRecord {
+  enum Type : uint8_t {
+    // Space preallocated but never written.
+    Empty = 0,
+    Header = 1,
+    // A frame published by an adapter.
+    Frame = 2,
+    // A rumble payload sent to an adapter.
+    Rumble = 3,
+    // An adapter was found to be gone.
+    Disconnect = 4,
+  };
+
+  // Since recording started, on the monotonic clock. Frames use the time
+  // their transfer completed.
+  uint64_t timeNs = 0;
+  // The low bits of a frame's sequence number.
+  uint16_t sequence = 0;
+  // The adapter's slot.
+  uint8_t slot = 0;
+  uint8_t type = Empty;
+  // The controller data of a frame, the rumble bytes of the four ports, or
+  // the header's magic.
+  uint8_t data[36]{};
+};
+static_assert(sizeof(InputLogRecord) == 48);
+static_assert(sizeof(Controller::GCInput) * 4 ==
+              sizeof(InputLogRecord::data));
+
+// Appends frames and rumble payloads from any number of threads into a
+// memory-mapped log. Each record costs one atomic increment and a 48-byte
+// copy. The file grows in preallocated segments, which a background thread
+// maps ahead of the writers, so recording makes no system calls on the hot
+// path. Records that find no segment ready are dropped.
+class InputRecorder {
+ public:
+  // Replaces any file at path. Throws std::runtime_error on failure.
+  explicit InputRecorder(const std::string& path);
+  // Trims the preallocated space off the end of the file.
+  ~InputRecorder();
+  InputRecorder(const InputRecorder&) = delete;
+  InputRecorder& operator=(const InputRecorder&) = delete;
+
+  void RecordFrame(size_t slot, const Controller::GCInput (&controllers)[4],
+                   const FrameInfo& frame);
+  void RecordRumble(size_t slot, const std::array<unsigned char, 5>& payload);
+  void RecordDisconnect(size_t slot);
+
+  // Records written so far, not counting the header.
+  uint64_t Records() const;
+  // Records lost because the file could not grow.
+  uint64_t Dropped() const { return dropped.load(std::memory_order_relaxed); }
+
+ private:
+  // Records per segment. Segments start on multiples of 64 KiB, as file views
+  // on Windows must.
+  static constexpr size_t SegmentRecords = 65536;
+  static constexpr size_t SegmentBytes =
+      SegmentRecords * sizeof(InputLogRecord);
+  // 12 GiB, or nine hours of eight adapters at 1000 Hz.
+  static constexpr size_t MaxSegments = 4096;
+  // Segments kept mapped past the one being written. A segment lasts half a
+  // second even with the full 128 adapters at 1000 Hz.
+  static constexpr size_t SegmentsAhead = 2;
+  static constexpr std::chrono::milliseconds GrowInterval{10};
+
+  // Claims the next record, or returns nullptr if the log is full or the grow
+  // thread has not mapped its segment yet.
+  InputLogRecord* Append(uint8_t type, size_t slot,
+                         std::chrono::steady_clock::time_point time);
+  // Preallocates and maps a segment. Only called from the constructor and the
+  // grow thread.
+  InputLogRecord* MapSegment(size_t segment);
+  // Keeps SegmentsAhead segments mapped until the recorder is destroyed.
+  void Grow();
+  void CloseFile();
+
+  const std::chrono::steady_clock::time_point startTime;
+  // The next record to claim. Record 0 is the header.
+  std::atomic<uint64_t> next = 1;
+  std::atomic<uint64_t> dropped = 0;
+  std::array<std::atomic<InputLogRecord*>, MaxSegments> segments{};
+
+  // Owned by the grow thread once it runs.
+  bool growFailed = false;
+  std::mutex growMutex;
+  std::condition_variable stopGrowing;
+  bool stopping = false;
+  std::thread growThread;
+#ifdef _WIN32
+  void* file = nullptr;
+#else
+  int fd = -1;
+#endif
+};
+
+// A log written by InputRecorder, mapped read-only.
+class InputLogReader {
+ public:
+  // Throws std::runtime_error if the file cannot be mapped or is not an input
+  // log.
+  explicit InputLogReader(const std::string& path);
+  ~InputLogReader();
+  InputLogReader(const InputLogReader&) = delete;
+  InputLogReader& operator=(const InputLogReader&) = delete;
+
+  // Records, including the header.
+  size_t Size() const { return size; }
+  const InputLogRecord& operator[](size_t index) const {
+    return records[index];
+  }
+
+ private:
+  void Unmap();
+
+  const InputLogRecord* records = nullptr;
+  size_t size = 0;
+  size_t mappedBytes = 0;
+};
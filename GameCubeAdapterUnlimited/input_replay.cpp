@@ -0,0 +1,163 @@
+#include "input_replay.hpp"
+
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <optional>
+
+#include "adapter.hpp"
+
+namespace {
+
+// An adapter whose frames come from an input log.
+class ReplayAdapter : public Adapter {
+ public:
+  ReplayAdapter() { ResetRumble(); }
+
+  bool Write(unsigned char* /*data*/, int /*length*/) override {
+    RecordWrite();
+    return true;
+  }
+  void Replay(const InputLogRecord& record) {
+    Inputs inputs;
+    // Real adapters prefix each frame with report ID 0x21.
+    inputs._pad[0] = 0x21;
+    memcpy(inputs.Controllers, record.data, sizeof(record.data));
+    // Like a real adapter, take at most one rumble payload per frame.
+    FlushRumble();
+    PublishInputs(inputs);
+  }
+  void Disconnect() { RecordDisconnect(); }
+};
+
+}  // namespace
+
+InputReplayer::InputReplayer(const std::string& path, double speed)
+    : log(path), speed(speed) {
+  thread = std::thread([this]() { Run(); });
+}
+
+InputReplayer::~InputReplayer() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    stopping = true;
+  }
+  stopRequested.notify_all();
+  thread.join();
+}
+
+void InputReplayer::Run() {
+  using namespace std::chrono;
+  std::array<std::shared_ptr<ReplayAdapter>, AdapterManager::MaxAdapters>
+      adapters;
+  const steady_clock::time_point start = steady_clock::now();
+  const auto due = [&](const InputLogRecord& record) {
+    if (speed <= 0) {
+      return start;
+    }
+    return start + duration_cast<steady_clock::duration>(
+                       duration<double, std::nano>(record.timeNs / speed));
+  };
+
+  uint64_t frames = 0;
+  bool stopped = false;
+  // Records that fell due together are handled in one pass, which signals
+  // the input loop once.
+  std::optional<FrameSignal::Batch> batch;
+  // Mailboxes hold one frame, so the input loop must take an adapter's frame
+  // before the next one is published, or a disconnect replayed. This is what
+  // paces a replay that outruns it.
+  const auto waitConsumed = [&](const ReplayAdapter& adapter) {
+    if (adapter.FrameConsumed()) {
+      return true;
+    }
+    // Deliver the deferred signal, or the input loop never wakes for it.
+    batch.reset();
+    const steady_clock::time_point giveUp = steady_clock::now() + MaxWait;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!adapter.FrameConsumed() && steady_clock::now() < giveUp) {
+      if (stopRequested.wait_for(lock, ConsumePoll,
+                                 [this] { return stopping; })) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  // Record 0 is the header.
+  size_t next = 1;
+  while (next < log.Size() && !stopped) {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      if (stopRequested.wait_until(lock, due(log[next]),
+                                   [this] { return stopping; })) {
+        stopped = true;
+        break;
+      }
+    }
+    const steady_clock::time_point now = steady_clock::now();
+    for (; next < log.Size() && due(log[next]) <= now; next++) {
+      const InputLogRecord& record = log[next];
+      if (record.slot >= adapters.size()) {
+        continue;
+      }
+      std::shared_ptr<ReplayAdapter>& adapter = adapters[record.slot];
+      if (adapter && (record.type == InputLogRecord::Frame ||
+                      record.type == InputLogRecord::Disconnect)) {
+        if (!waitConsumed(*adapter)) {
+          stopped = true;
+          break;
+        }
+      }
+      if (!batch) {
+        batch.emplace(Adapter::newInputs);
+      }
+      switch (record.type) {
+        case InputLogRecord::Frame:
+          if (!adapter) {
+            adapter = std::make_shared<ReplayAdapter>();
+            if (!AdapterManager::AddAdapter(adapter, record.slot)) {
+              adapter.reset();
+              break;
+            }
+          }
+          adapter->Replay(record);
+          frames++;
+          break;
+        case InputLogRecord::Rumble:
+          if (adapter) {
+            for (size_t port = 0; port < 4; port++) {
+              adapter->SetRumble(port, record.data[port]);
+            }
+          }
+          break;
+        case InputLogRecord::Disconnect:
+          if (adapter) {
+            adapter->Disconnect();
+            adapter.reset();
+          }
+          break;
+        default:
+          // Space the recorder preallocated but never wrote.
+          break;
+      }
+    }
+    batch.reset();
+  }
+
+  // Let the input loop take the last frames before the adapters go.
+  for (std::shared_ptr<ReplayAdapter>& adapter : adapters) {
+    if (adapter) {
+      if (!stopped && !waitConsumed(*adapter)) {
+        stopped = true;
+      }
+      adapter->Disconnect();
+    }
+  }
+  if (!stopped) {
+    std::cout << "Replay finished after " << frames << " frames" << std::endl;
+    finished = true;
+  }
+}
@@ -0,0 +1,44 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "input_log.hpp"
+
+// Feeds an input log back through the normal pipeline, in place of real
+// adapters. Each slot in the log gets an adapter that publishes the recorded
+// frames at their original pace, scaled by the speed factor, and receives the
+// recorded rumble requests. Adapters disconnect where they did in the log, and
+// at its end. A replay never publishes over a frame the input loop has not
+// taken yet, so even the fastest one delivers every frame.
+class InputReplayer {
+ public:
+  // A speed of 2 replays twice as fast. 0 replays as fast as possible.
+  // Throws std::runtime_error if the log cannot be read.
+  InputReplayer(const std::string& path, double speed);
+  ~InputReplayer();
+
+  // Whether every record was replayed.
+  bool Finished() const { return finished; }
+
+ private:
+  // How often to check whether the input loop took a frame, and how long to
+  // wait for it before publishing over it anyway.
+  static constexpr std::chrono::microseconds ConsumePoll{50};
+  static constexpr std::chrono::milliseconds MaxWait{100};
+
+  void Run();
+
+  const InputLogReader log;
+  const double speed;
+
+  std::mutex mutex;
+  std::condition_variable stopRequested;
+  bool stopping = false;
+  std::atomic<bool> finished = false;
+  std::thread thread;
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Assumed size of a cache line. Mailboxes are aligned to it, so adapters
+// written from different threads never share a line.
+constexpr size_t CacheLineSize = 64;
+
+// Holds the most recent value written by a single writer thread, readable
+// from any thread without locking. A seqlock: the writer never waits, and a
+// reader retries if it overlapped with a write.
+template <typename T>
+class alignas(CacheLineSize) LatestValueMailbox {
+  static_assert(std::is_trivially_copyable_v<T>);
+  static constexpr size_t NumWords = (sizeof(T) + 7) / 8;
+
+  // Odd while a write is in progress. Zero until the first write.
+  std::atomic<uint64_t> sequence = 0;
+  // The value, held as atomic words so that torn reads are well-defined.
+  std::array<std::atomic<uint64_t>, NumWords> words{};
+
+ public:
+  // Must only be called from one thread at a time.
+  void Store(const T& value) {
+    uint64_t buffer[NumWords]{};
+    memcpy(buffer, &value, sizeof(T));
+    const uint64_t seq = sequence.load(std::memory_order_relaxed);
+    sequence.store(seq + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    for (size_t i = 0; i < NumWords; i++) {
+      words[i].store(buffer[i], std::memory_order_relaxed);
+    }
+    sequence.store(seq + 2, std::memory_order_release);
+  }
+
+  // Copies out the latest value and returns its sequence number, which grows
+  // with every Store(). Returns 0, leaving value untouched, if nothing was
+  // stored yet.
+  uint64_t Load(T& value) const {
+    uint64_t buffer[NumWords];
+    uint64_t before;
+    uint64_t after;
+    do {
+      before = sequence.load(std::memory_order_acquire);
+      for (size_t i = 0; i < NumWords; i++) {
+        buffer[i] = words[i].load(std::memory_order_relaxed);
+      }
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = sequence.load(std::memory_order_relaxed);
+    } while (before != after || (before & 1));
+    if (before != 0) {
+      memcpy(&value, buffer, sizeof(T));
+    }
+    return before;
+  }
+
+  // The sequence number of the latest value, without copying it.
+  uint64_t Sequence() const { return sequence.load(std::memory_order_acquire); }
+};
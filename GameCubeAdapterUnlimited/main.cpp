@@ -1,28 +1,50 @@
+#ifdef _WIN32
 #include <windows.h>
 // Windows header must be defined before these to prevent build errors.
 #include <ViGEm/Client.h>
+#else
+#include <signal.h>
+#endif
 #include <libusb/libusb.h>
 
+#include <algorithm>
 #include <array>
 #include <atomic>
 #include <bitset>
 #include <chrono>
+#include <condition_variable>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
 #include <sstream>
 #include <stdexcept>
 #include <string>
 #include <thread>
+#include <tuple>
 #include <vector>
 
+#include "adapter.hpp"
+#include "adapter_thread.hpp"
+#include "controller.hpp"
+#include "debug.hpp"
+#include "input_log.hpp"
+#include "input_replay.hpp"
+#include "padsink.hpp"
+#include "simulated_adapter.hpp"
+#include "slot_map.hpp"
+#include "stats_reporter.hpp"
+#ifdef _WIN32
 #include "removeall.hpp"
+#include "vigem_sink.hpp"
+#endif
+#ifdef __linux__
+#include "uinput_sink.hpp"
+#endif
 
-class AdapterThread;
-
-constexpr bool DEBUG = false;
-
-static AdapterThread* adapterThreadContext = nullptr;
-
-static bool running = true;
+static std::atomic<bool> running = true;
+#ifdef _WIN32
 BOOL WINAPI CtrlHandler(DWORD event) {
   if (event == CTRL_CLOSE_EVENT) {
     running = false;
@@ -31,153 +53,326 @@ BOOL WINAPI CtrlHandler(DWORD event) {
   }
   return FALSE;
 }
+#else
+void SignalHandler(int) { running = false; }
+#endif
 
-struct Controller {
-#pragma pack(push, 1)
-  struct GCInput {
-    union {
-      // Status bits layout: https://hitmen.c02.at/files/yagcd/yagcd/chap9.html
-      unsigned char Status;
-      struct {
-        // Wireless (1: wireless Controller)
-        unsigned char Wireless : 1;
-        // Wireless receive (0: not wireless 1: wireless)
-        unsigned char WirelessReceive : 1;
-        // This bit is set when the grey USB cable is attached, to power rumble.
-        unsigned char CanRumble : 1;
-        // Seemingly always 0.
-        unsigned char _pad : 1;
-        // Controller type (0: N64, 1: GameCube)
-        unsigned char Console : 1;
-        // Wireless type (0:IF 1:RF)
-        unsigned char WirelessType : 1;
-        // Wireless state (0: variable 1: fixed)
-        unsigned char WirelessState : 1;
-        // 0: Non-standard controller, 1: Standard GameCube controller
-        unsigned char Standard : 1;
-      };
-    };
-    union {
-      unsigned short Buttons;
-      struct {
-        unsigned short A : 1;
-        unsigned short B : 1;
-        unsigned short X : 1;
-        unsigned short Y : 1;
-        unsigned short DpadLeft : 1;
-        unsigned short DpadRight : 1;
-        unsigned short DpadDown : 1;
-        unsigned short DpadUp : 1;
-        unsigned short Start : 1;
-        unsigned short Z : 1;
-        unsigned short R : 1;
-        unsigned short L : 1;
-      };
-    };
-    unsigned char AnalogX;
-    unsigned char AnalogY;
-    unsigned char CStickX;
-    unsigned char CStickY;
-    unsigned char LeftTrigger;
-    unsigned char RightTrigger;
-
-    GCInput()
-        : Status(0),
-          Buttons(0),
-          AnalogX(128),
-          AnalogY(128),
-          CStickX(128),
-          CStickY(128),
-          LeftTrigger(0),
-          RightTrigger(0) {};
-    // NOTE: This bit is always 1 when a GameCube controller is attached.
-    bool On() { return Console; }
-  };
-#pragma pack(pop)
-
-  static _DS4_REPORT GCtoDS4(const GCInput& gc) {
-    _DS4_REPORT ds4{};
-
-    ds4.bThumbLX = gc.AnalogX;
-    ds4.bThumbLY = ~gc.AnalogY;
-    ds4.bThumbRX = gc.CStickX;
-    ds4.bThumbRY = ~gc.CStickY;
-
-    ds4.wButtons = 0;
-    if (gc.Start) ds4.wButtons |= DS4_BUTTON_OPTIONS;
-    if (gc.Z) ds4.wButtons |= DS4_BUTTON_SHARE;
-    if (gc.R) ds4.wButtons |= DS4_BUTTON_SHOULDER_RIGHT;
-    if (gc.L) ds4.wButtons |= DS4_BUTTON_SHOULDER_LEFT;
-    if (gc.X) ds4.wButtons |= DS4_BUTTON_TRIANGLE;
-    if (gc.A) ds4.wButtons |= DS4_BUTTON_CIRCLE;
-    if (gc.B) ds4.wButtons |= DS4_BUTTON_CROSS;
-    if (gc.Y) ds4.wButtons |= DS4_BUTTON_SQUARE;
-
-    if (gc.DpadUp && gc.DpadLeft)
-      ds4.wButtons |= DS4_BUTTON_DPAD_NORTHWEST;
-    else if (gc.DpadDown && gc.DpadLeft)
-      ds4.wButtons |= DS4_BUTTON_DPAD_SOUTHWEST;
-    else if (gc.DpadDown && gc.DpadRight)
-      ds4.wButtons |= DS4_BUTTON_DPAD_SOUTHEAST;
-    else if (gc.DpadUp && gc.DpadRight)
-      ds4.wButtons |= DS4_BUTTON_DPAD_NORTHEAST;
-    else if (gc.DpadUp)
-      ds4.wButtons |= DS4_BUTTON_DPAD_NORTH;
-    else if (gc.DpadLeft)
-      ds4.wButtons |= DS4_BUTTON_DPAD_WEST;
-    else if (gc.DpadDown)
-      ds4.wButtons |= DS4_BUTTON_DPAD_SOUTH;
-    else if (gc.DpadRight)
-      ds4.wButtons |= DS4_BUTTON_DPAD_EAST;
-    else
-      ds4.wButtons |= DS4_BUTTON_DPAD_NONE;
-
-    ds4.bTriggerL = gc.LeftTrigger;
-    ds4.bTriggerR = gc.RightTrigger;
-
-    return ds4;
-  }
-};
-
-class Adapter {
+// An adapter attached over USB.
+class LibUSBAdapter : public Adapter {
   static const unsigned char ReadEndpoint = 1 | LIBUSB_ENDPOINT_IN;
   static const unsigned char WriteEndpoint = 2 | LIBUSB_ENDPOINT_OUT;
+  // Interrupt reads kept submitted at all times. With two in flight, the next
+  // frame can land while the previous completion is still being handled.
+  static const size_t NumReadTransfers = 2;
 
+  libusb_context* context;
   libusb_device_handle* dev_handle;
-  std::array<unsigned char, 5> rumblePayload;
+  // Copied at construction, so a change never affects transfers in flight.
+  const AdapterWritePolicy policy = writePolicy;
 
-  size_t failedReads = 0;
+  // Always-in-flight interrupt reads and their destination buffers.
+  std::array<libusb_transfer*, NumReadTransfers> readTransfers{};
+  std::array<Inputs, NumReadTransfers> readBuffers{};
+  // When each read was last submitted, for latency statistics.
+  std::array<std::chrono::steady_clock::time_point, NumReadTransfers>
+      submitTimes{};
+  // The rumble write, submitted from read completions with the latest
+  // requested state, so at most one is sent per frame.
+  libusb_transfer* rumbleTransfer = nullptr;
+  std::array<unsigned char, 5> rumbleBuffer{};
+  bool rumbleInFlight = false;
+  // Failed attempts at the payload in rumbleBuffer.
+  unsigned int rumbleFailures = 0;
+  std::chrono::steady_clock::time_point rumbleSubmitTime;
+  // Guards submission against cancellation, so that StopReading() never
+  // misses a transfer that a completion callback is about to resubmit.
+  std::mutex transferMutex;
+  bool stopping = false;
+  // Read and rumble transfers.
+  size_t inFlight = 0;
+  // Set once every transfer has completed after StopReading().
+  int transfersStopped = 0;
 
-  bool ReadInterrupt(unsigned char* data, const int& length,
-                     const int& timeoutMs) {
-    int actual;
-    const int interrupt = libusb_interrupt_transfer(
-        dev_handle, ReadEndpoint, data, length, &actual, timeoutMs);
-    if (interrupt < LIBUSB_SUCCESS) {
-      std::cout << "libusb_interrupt_transfer failed: " << interrupt
-                << std::endl;
+  static void LIBUSB_CALL OnReadComplete(libusb_transfer* transfer) {
+    LibUSBAdapter* adapter = static_cast<LibUSBAdapter*>(transfer->user_data);
+    adapter->HandleReadComplete(transfer);
+  }
+  // Which of the read transfers this is.
+  size_t ReadIndex(libusb_transfer* transfer) {
+    return reinterpret_cast<Inputs*>(transfer->buffer) - readBuffers.data();
+  }
+  void HandleReadComplete(libusb_transfer* transfer) {
+    const std::chrono::steady_clock::time_point received =
+        std::chrono::steady_clock::now();
+    bool resubmit = true;
+    switch (transfer->status) {
+      case LIBUSB_TRANSFER_COMPLETED:
+        stats.readLatency.Record(received - submitTimes[ReadIndex(transfer)]);
+        if (transfer->actual_length == sizeof(Inputs)) {
+          PublishInputs(*reinterpret_cast<Inputs*>(transfer->buffer),
+                        received);
+        } else {
+          RecordFailedRead();
+        }
+        break;
+      case LIBUSB_TRANSFER_CANCELLED:
+        resubmit = false;
+        break;
+      case LIBUSB_TRANSFER_NO_DEVICE:
+        RecordDisconnect();
+        resubmit = false;
+        break;
+      default:
+        if (DEBUG) {
+          std::cout << "Interrupt transfer failed with status: "
+                    << transfer->status << std::endl;
+        }
+        RecordFailedRead();
+        break;
+    }
+
+    std::lock_guard<std::mutex> lock(transferMutex);
+    if (ShouldDisconnect()) {
+      Abandon();
+    }
+    if (resubmit && !stopping) {
+      SubmitRumble();
+      submitTimes[ReadIndex(transfer)] = std::chrono::steady_clock::now();
+      const int submit = libusb_submit_transfer(transfer);
+      if (submit == LIBUSB_SUCCESS) {
+        return;
+      }
+      std::cout << "libusb_submit_transfer failed: " << submit << std::endl;
+      RecordDisconnect();
+    }
+    if (--inFlight == 0) {
+      transfersStopped = 1;
+    }
+  }
+  // Sends the pending rumble state, unless the previous write is still in
+  // flight. Called with transferMutex held.
+  void SubmitRumble() {
+    if (!rumbleTransfer || rumbleInFlight ||
+        !TakeRumblePayload(rumbleBuffer)) {
+      return;
+    }
+    rumbleFailures = 0;
+    if (!SubmitRumbleAttempt()) {
+      return;
+    }
+    rumbleInFlight = true;
+    inFlight++;
+  }
+  bool SubmitRumbleAttempt() {
+    rumbleSubmitTime = std::chrono::steady_clock::now();
+    const int submit = libusb_submit_transfer(rumbleTransfer);
+    if (submit < LIBUSB_SUCCESS) {
+      std::cout << "libusb_submit_transfer failed: " << submit << std::endl;
+      RecordFailedWrite();
+      RetryRumble();
+      return false;
+    }
+    return true;
+  }
+  static void LIBUSB_CALL OnRumbleComplete(libusb_transfer* transfer) {
+    LibUSBAdapter* adapter = static_cast<LibUSBAdapter*>(transfer->user_data);
+    adapter->HandleRumbleComplete(transfer);
+  }
+  void HandleRumbleComplete(libusb_transfer* transfer) {
+    stats.rumbleWrite.Record(std::chrono::steady_clock::now() -
+                             rumbleSubmitTime);
+    std::lock_guard<std::mutex> lock(transferMutex);
+    switch (transfer->status) {
+      case LIBUSB_TRANSFER_COMPLETED:
+        RecordWrite();
+        break;
+      case LIBUSB_TRANSFER_CANCELLED:
+        break;
+      case LIBUSB_TRANSFER_NO_DEVICE:
+        Abandon();
+        break;
+      default:
+        std::cout << "Rumble write failed with status: " << transfer->status
+                  << std::endl;
+        // Retry the same payload while the policy allows.
+        if (++rumbleFailures <= policy.retries && !stopping) {
+          if (SubmitRumbleAttempt()) {
+            return;
+          }
+          break;
+        }
+        RecordFailedWrite();
+        // Send the latest state with a later frame, unless the adapter is
+        // being dropped.
+        RetryRumble();
+        if (ShouldDisconnect()) {
+          Abandon();
+        }
+        break;
+    }
+    rumbleInFlight = false;
+    if (--inFlight == 0) {
+      transfersStopped = 1;
+    }
+  }
+  void StartReading() {
+    std::lock_guard<std::mutex> lock(transferMutex);
+    rumbleTransfer = libusb_alloc_transfer(0);
+    if (rumbleTransfer) {
+      libusb_fill_bulk_transfer(
+          rumbleTransfer, dev_handle, WriteEndpoint, rumbleBuffer.data(),
+          static_cast<int>(rumbleBuffer.size()),
+          &LibUSBAdapter::OnRumbleComplete, this,
+          static_cast<unsigned int>(policy.timeout.count()));
+    } else {
+      std::cout << "libusb_alloc_transfer failed" << std::endl;
+    }
+    for (size_t i = 0; i < NumReadTransfers; i++) {
+      libusb_transfer* transfer = libusb_alloc_transfer(0);
+      if (!transfer) {
+        std::cout << "libusb_alloc_transfer failed" << std::endl;
+        break;
+      }
+      readTransfers[i] = transfer;
+      libusb_fill_interrupt_transfer(
+          transfer, dev_handle, ReadEndpoint,
+          reinterpret_cast<unsigned char*>(&readBuffers[i]), sizeof(Inputs),
+          &LibUSBAdapter::OnReadComplete, this, ReadTimeoutMs);
+      submitTimes[i] = std::chrono::steady_clock::now();
+      const int submit = libusb_submit_transfer(transfer);
+      if (submit < LIBUSB_SUCCESS) {
+        std::cout << "libusb_submit_transfer failed: " << submit << std::endl;
+        RecordDisconnect();
+        break;
+      }
+      inFlight++;
+    }
+    transfersStopped = inFlight == 0;
+  }
+  // Stops resubmission and cancels the in-flight transfers. Called with
+  // transferMutex held.
+  void CancelTransfers() {
+    if (stopping) {
+      return;
+    }
+    stopping = true;
+    for (libusb_transfer* transfer : readTransfers) {
+      if (transfer) {
+        libusb_cancel_transfer(transfer);
+      }
+    }
+    if (rumbleInFlight) {
+      libusb_cancel_transfer(rumbleTransfer);
+    }
+  }
+  // The adapter is about to be dropped. Stops its transfers rather than
+  // waiting out their timeouts, and makes sure it stays marked for removal.
+  // Called with transferMutex held.
+  void Abandon() {
+    RecordDisconnect();
+    CancelTransfers();
+  }
+  // Completion of a transfer run by RunTransfer().
+  struct PendingTransfer {
+    std::mutex mutex;
+    std::condition_variable done;
+    bool completed = false;
+  };
+  static void LIBUSB_CALL OnTransferComplete(libusb_transfer* transfer) {
+    PendingTransfer* pending =
+        static_cast<PendingTransfer*>(transfer->user_data);
+    // Notified under the lock, as the waiter destroys pending once it sees
+    // the completion.
+    std::lock_guard<std::mutex> lock(pending->mutex);
+    pending->completed = true;
+    pending->done.notify_all();
+  }
+  // Submits a one-off transfer and waits for the LibUSB event thread to
+  // complete it. Unlike libusb's synchronous API, this thread never handles
+  // events itself, so adapters being opened don't compete with the event
+  // thread for the event lock. Frees the transfer, and returns a libusb error
+  // code like the synchronous API does.
+  int RunTransfer(libusb_transfer* transfer, int* actual = nullptr) {
+    if (!transfer) {
+      return LIBUSB_ERROR_NO_MEM;
+    }
+    PendingTransfer pending;
+    transfer->callback = &LibUSBAdapter::OnTransferComplete;
+    transfer->user_data = &pending;
+    int result = libusb_submit_transfer(transfer);
+    if (result == LIBUSB_SUCCESS) {
+      {
+        std::unique_lock<std::mutex> lock(pending.mutex);
+        pending.done.wait(lock, [&] { return pending.completed; });
+      }
+      switch (transfer->status) {
+        case LIBUSB_TRANSFER_COMPLETED:
+          break;
+        case LIBUSB_TRANSFER_TIMED_OUT:
+          result = LIBUSB_ERROR_TIMEOUT;
+          break;
+        case LIBUSB_TRANSFER_STALL:
+          result = LIBUSB_ERROR_PIPE;
+          break;
+        case LIBUSB_TRANSFER_NO_DEVICE:
+          result = LIBUSB_ERROR_NO_DEVICE;
+          break;
+        case LIBUSB_TRANSFER_OVERFLOW:
+          result = LIBUSB_ERROR_OVERFLOW;
+          break;
+        default:
+          result = LIBUSB_ERROR_IO;
+          break;
+      }
+      if (actual) {
+        *actual = transfer->actual_length;
+      }
     }
-    return interrupt == LIBUSB_SUCCESS && length == actual;
+    libusb_free_transfer(transfer);
+    return result;
   }
-  bool WriteRumble() {
-    unsigned char* data = rumblePayload.data();
-    const int length = static_cast<int>(rumblePayload.size());
-    return Write(data, length);
+
+  // Cancels the in-flight transfers and waits for their callbacks to finish,
+  // so the transfers can be freed.
+  void StopReading() {
+    {
+      std::lock_guard<std::mutex> lock(transferMutex);
+      CancelTransfers();
+    }
+    // Completions are normally handled by the LibUSB event thread. Handling
+    // events here as well keeps shutdown working once that thread has exited.
+    while (true) {
+      {
+        std::lock_guard<std::mutex> lock(transferMutex);
+        if (inFlight == 0) {
+          break;
+        }
+      }
+      timeval tv{0, 100000};
+      libusb_handle_events_timeout_completed(context, &tv, &transfersStopped);
+    }
+    for (libusb_transfer*& transfer : readTransfers) {
+      libusb_free_transfer(transfer);
+      transfer = nullptr;
+    }
+    libusb_free_transfer(rumbleTransfer);
+    rumbleTransfer = nullptr;
   }
 
  public:
-  struct Inputs {
-    // Padding to align inputs we get from the USB transfer with the Controller
-    // struct.
-    unsigned char _pad[1]{};
-    Controller::GCInput Controllers[4]{};
-  };
-  Adapter(libusb_device_handle* dev_handle) {
+  LibUSBAdapter(libusb_context* context, libusb_device_handle* dev_handle) {
+    this->context = context;
     this->dev_handle = dev_handle;
     // This call makes Nyko-brand (and perhaps other) adapters work.
     // However it returns LIBUSB_ERROR_PIPE with Mayflash adapters.
-    const int transfer = libusb_control_transfer(dev_handle, 0x21, 11, 0x0001,
-                                                 0, nullptr, 0, 1000);
+    std::array<unsigned char, LIBUSB_CONTROL_SETUP_SIZE> setup{};
+    libusb_fill_control_setup(setup.data(), 0x21, 11, 0x0001, 0, 0);
+    libusb_transfer* control = libusb_alloc_transfer(0);
+    if (control) {
+      libusb_fill_control_transfer(control, dev_handle, setup.data(), nullptr,
+                                   nullptr, 1000);
+    }
+    const int transfer = RunTransfer(control);
     if (transfer == LIBUSB_ERROR_PIPE) {
       std::cout << "Mayflash adapter detected." << std::endl;
     } else if (transfer < LIBUSB_SUCCESS) {
@@ -193,10 +388,13 @@ class Adapter {
     unsigned char init = 0x13;
     Write(&init, 1);
 
-    // Rumble should default to off.
+    // Rumble should default to off. Sent with the first frame.
     ResetRumble();
+
+    StartReading();
   }
-  ~Adapter() {
+  ~LibUSBAdapter() {
+    StopReading();
     const int release = libusb_release_interface(dev_handle, 0);
     if (release < LIBUSB_SUCCESS) {
       std::cout << "libusb_release_interface failed: " << release << std::endl;
@@ -206,441 +404,543 @@ class Adapter {
   bool DoesHandleMatch(libusb_device_handle* dev_handle) {
     return this->dev_handle == dev_handle;
   }
-  bool DoesHandleMatch(Adapter* adapter) {
+  bool DoesHandleMatch(LibUSBAdapter* adapter) {
     if (!adapter) {
       std::cout << "Requested DoesHandleMatch on null adapter" << std::endl;
       return false;
     }
     return DoesHandleMatch(adapter->dev_handle);
   }
-  bool Write(unsigned char* data, int length) {
-    int actual;
-    const int bulk = libusb_bulk_transfer(dev_handle, WriteEndpoint, data,
-                                          length, &actual, 0);
-    if (bulk < LIBUSB_SUCCESS) {
-      std::cout << "libusb_bulk_transfer failed: " << bulk << std::endl;
-    }
-    return bulk == LIBUSB_SUCCESS && length == actual;
-  }
-  bool GetInputs(Inputs& inputs) {
-    const int timeoutMs = 16;
-    return ReadInterrupt((unsigned char*)&inputs, sizeof(Inputs), timeoutMs);
+  libusb_device* Device() { return libusb_get_device(dev_handle); }
+  // Called when the device is known to be gone, ahead of the failing reads.
+  void MarkDisconnected() {
+    std::lock_guard<std::mutex> lock(transferMutex);
+    Abandon();
   }
-  // Detect timeouts due to multiple failed reads.
-  bool ShouldDisconnect(const bool& gotLastInput) {
-    if (gotLastInput) {
-      failedReads = 0;
-      return false;
-    }
-    if (failedReads++ > 20) {
-      return true;
+  // Blocks for at most (retries + 1) * timeout. Only used before the
+  // read and rumble transfers start.
+  bool Write(unsigned char* data, int length) override {
+    for (unsigned int attempt = 0; attempt <= policy.retries; attempt++) {
+      libusb_transfer* transfer = libusb_alloc_transfer(0);
+      if (transfer) {
+        libusb_fill_bulk_transfer(
+            transfer, dev_handle, WriteEndpoint, data, length, nullptr,
+            nullptr, static_cast<unsigned int>(policy.timeout.count()));
+      }
+      int actual = 0;
+      const int bulk = RunTransfer(transfer, &actual);
+      if (bulk == LIBUSB_SUCCESS && length == actual) {
+        RecordWrite();
+        return true;
+      }
+      std::cout << "Bulk write failed: " << bulk << std::endl;
+      if (bulk == LIBUSB_ERROR_NO_DEVICE) {
+        RecordDisconnect();
+        return false;
+      }
     }
+    RecordFailedWrite();
     return false;
   }
-  bool ResetRumble() {
-    rumblePayload = {0x11, 0x0, 0x0, 0x0, 0x0};
-    return WriteRumble();
-  }
-  // index: The controller port to assign the rumble value to.
-  // val: the rumble state to use. The following rumble bits are supported:
-  // 0b00000001: Enable rumble.
-  // 0b00000010: Enable motor braking.
-  // Both can (but should not) be used at the same time.
-  bool SetRumble(ssize_t index, unsigned char val) {
-    if (index < 0 || index >= 4) {
-      std::cout << "Rumble index out of range: " << index << std::endl;
-      return false;
-    }
+};
+
+class LibUSB {
+  // The vendor and product IDs associated with GameCube controller adapters.
+  // Any adapter placed in Wii U/Switch mode will appear with these IDs.
+  static const int VENDOR_ID = 0x57E;
+  static const int PRODUCT_ID = 0x337;
 
-    // NOTE: Rumble should probably be disabled in the following circumstances,
-    // but it seems to not matter, so we ignore it for now:
-    // The controller is wireless. WaveBirds do not have rumble functionality.
-    // The grey USB cable is disconnected. Without it, there isn't enough power
-    // for the motors.
-    // The controller is disconnected. Rumble for detached controllers is
-    // pointless.
+  libusb_context* context = nullptr;
 
-    rumblePayload[1 + index] = val;
+  // Completions for every adapter's asynchronous transfers are dispatched from
+  // this thread.
+  std::thread eventThread;
+  std::atomic<bool> handlingEvents = false;
 
-    if (DEBUG) {
-      std::cout << "Rumble payload: ";
-      for (const auto& val : rumblePayload) {
-        std::cout << "0x" << std::hex << static_cast<int>(val) << ", ";
-      }
-      std::cout << std::endl;
+  // Set when the platform reports device arrivals and departures, making full
+  // bus scans unnecessary.
+  bool hotplug = false;
+  libusb_hotplug_callback_handle hotplugHandle;
+  // Where a device sits on the bus. Stable while it stays plugged in.
+  struct UsbLocation {
+    uint8_t bus = 0;
+    std::array<uint8_t, 7> ports{};
+    uint8_t address = 0;
+    bool operator<(const UsbLocation& other) const {
+      return std::tie(bus, ports, address) <
+             std::tie(other.bus, other.ports, other.address);
     }
-
-    return WriteRumble();
+  };
+  static UsbLocation GetLocation(libusb_device* device) {
+    UsbLocation location;
+    location.bus = libusb_get_bus_number(device);
+    libusb_get_port_numbers(device, location.ports.data(),
+                            static_cast<int>(location.ports.size()));
+    location.address = libusb_get_device_address(device);
+    return location;
   }
-};
-
-class AdapterManager {
- public:
-  using AdapterList = std::vector<std::shared_ptr<Adapter>>;
+  // Names the physical port a device is plugged into, like "1-4.2" for port 2
+  // of a hub on port 4 of bus 1. Unlike the address, this survives replugging
+  // and restarts. Empty if the port is unknown.
+  static std::string GetPortPath(libusb_device* device) {
+    std::array<uint8_t, 7> ports;
+    const int numPorts = libusb_get_port_numbers(
+        device, ports.data(), static_cast<int>(ports.size()));
+    if (numPorts <= 0) {
+      return "";
+    }
+    std::stringstream ss;
+    ss << static_cast<int>(libusb_get_bus_number(device));
+    for (int i = 0; i < numPorts; i++) {
+      ss << (i == 0 ? "-" : ".") << static_cast<int>(ports[i]);
+    }
+    return ss.str();
+  }
+  // The slot each port's adapter was given before.
+  SlotMap slotMap;
+  // An adapter another program holds, like Dolphin, is retried after 2
+  // seconds, then after twice as long each time up to 30 seconds, so that it
+  // is picked up soon after the program lets go of it.
+  struct OpenRetry {
+    int failures = 0;
+    std::chrono::steady_clock::time_point next;
+    bool Due(std::chrono::steady_clock::time_point now) const {
+      return failures == 0 || now >= next;
+    }
+    void Failed(std::chrono::steady_clock::time_point now) {
+      failures++;
+      const std::chrono::seconds delay(2 << std::min(failures - 1, 4));
+      next = now + std::min(delay, std::chrono::seconds(30));
+    }
+  };
+  // What earlier bus scans found at each location.
+  struct KnownDevice {
+    // The scan that last saw the device.
+    uint64_t lastScan = 0;
+    bool isAdapter = false;
+    // Set while we own the adapter.
+    std::weak_ptr<Adapter> adapter;
+    // For an adapter we could not open.
+    OpenRetry retry;
+  };
+  std::map<UsbLocation, KnownDevice> knownDevices;
+  uint64_t scanNumber = 0;
+  // With hotplug events, every adapter that is plugged in. Each device holds
+  // a reference.
+  struct PluggedAdapter {
+    libusb_device* device;
+    // Set while we own the adapter.
+    std::weak_ptr<Adapter> adapter;
+    // Whether adapter was set by the last open, so a drop can be noticed.
+    bool opened = false;
+    // For an adapter we could not open, or that we dropped.
+    OpenRetry retry;
+  };
+  std::vector<PluggedAdapter> pluggedAdapters;
 
- private:
-  static inline std::atomic<std::shared_ptr<const AdapterList>> g_adapters{
-      std::make_shared<const AdapterList>()};
+  // Hotplug events not handled yet. Each device holds a reference.
+  std::mutex hotplugMutex;
+  std::condition_variable hotplugEvents;
+  std::vector<libusb_device*> arrivals;
+  std::vector<libusb_device*> departures;
 
- public:
-  static std::shared_ptr<const AdapterList> AcquireRead() {
-    return g_adapters.load(std::memory_order_acquire);
-  }
-
-  static void AddAdapter(std::shared_ptr<Adapter> newAdapter) {
-    auto old_list = g_adapters.load(std::memory_order_acquire);
-    std::shared_ptr<AdapterList> new_list;
-    size_t index;
-    do {
-      new_list = std::make_shared<AdapterList>(*old_list);
-      // Look for an existing empty stub (nullptr) to reuse.
-      auto it = std::find(new_list->begin(), new_list->end(), nullptr);
-      if (it != new_list->end()) {
-        // Fill the stub.
-        *it = newAdapter;
-        index = std::distance(new_list->begin(), it);
+  // Runs on the event thread. Opening an adapter waits for transfers, and
+  // closing one waits for its reads to be cancelled, neither of which can
+  // complete while this thread is busy. Events are handed to PollDevices()
+  // instead.
+  static int LIBUSB_CALL OnHotplug(libusb_context* /*context*/,
+                                   libusb_device* device,
+                                   libusb_hotplug_event event,
+                                   void* user_data) {
+    LibUSB* libUsb = static_cast<LibUSB*>(user_data);
+    {
+      std::lock_guard<std::mutex> lock(libUsb->hotplugMutex);
+      if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+        libUsb->arrivals.push_back(libusb_ref_device(device));
       } else {
-        // No stubs found, append to the end.
-        new_list->push_back(newAdapter);
-        index = new_list->size() - 1;
-      }
-    } while (!g_adapters.compare_exchange_weak(old_list, new_list,
-                                               std::memory_order_acq_rel,
-                                               std::memory_order_acquire));
-    std::cout << "Adapter " << index + 1 << " connected" << std::endl;
-  }
-
-  static void RemoveAdapter(Adapter* target_raw_ptr) {
-    auto old_list = g_adapters.load(std::memory_order_acquire);
-    std::shared_ptr<AdapterList> new_list;
-    size_t index;
-    do {
-      new_list = std::make_shared<AdapterList>(*old_list);
-      bool found = false;
-      // Find the adapter by raw pointer and replace it with a stub.
-      for (size_t i = 0; i < new_list->size(); i++) {
-        if ((*new_list)[i] && (*new_list)[i].get() == target_raw_ptr) {
-          (*new_list)[i] = nullptr;
-          index = i;
-          found = true;
-          break;
-        }
+        libUsb->departures.push_back(libusb_ref_device(device));
       }
-      // Already removed or not found.
-      if (!found) return;
-    } while (!g_adapters.compare_exchange_weak(old_list, new_list,
-                                               std::memory_order_acq_rel,
-                                               std::memory_order_acquire));
-    std::cout << "Adapter " << index + 1 << " disconnected" << std::endl;
+    }
+    libUsb->hotplugEvents.notify_all();
+    // Stay registered.
+    return 0;
   }
-};
 
-// Forward declaration.
-_Function_class_(EVT_VIGEM_DS4_NOTIFICATION) VOID
-    UpdateRumble(PVIGEM_CLIENT Client, PVIGEM_TARGET Target, UCHAR LargeMotor,
-                 UCHAR SmallMotor, DS4_LIGHTBAR_COLOR LightbarColor);
+  // Each wake-up dispatches every completion that is ready, for all
+  // adapters, then signals the input loop once for all the frames they
+  // delivered.
+  void HandleEvents() {
+    while (handlingEvents) {
+      FrameSignal::Batch batch(Adapter::newInputs);
+      timeval tv{1, 0};
+      libusb_handle_events_timeout_completed(context, &tv, nullptr);
+    }
+  }
 
-class ViGEmClient {
  public:
-  PVIGEM_CLIENT client;
-
-  ViGEmClient() {
-    client = vigem_alloc();
-    if (!client) {
-      throw std::runtime_error("vigem_alloc failed");
+  explicit LibUSB(const std::string& slotFile)
+      : slotMap(slotFile, AdapterManager::MaxAdapters) {
+    const int init = libusb_init(&context);
+    if (init < LIBUSB_SUCCESS) {
+      // Without USB access the feeder can still serve other adapter sources.
+      std::cout << "libusb_init failed: " << init << std::endl;
+      context = nullptr;
+      return;
     }
-    const VIGEM_ERROR retval = vigem_connect(client);
-    if (!VIGEM_SUCCESS(retval)) {
-      std::stringstream ss;
-      ss << "vigem_connect failed with error code: 0x" << std::hex << retval
-         << std::endl;
-      throw std::runtime_error(ss.str());
+    if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG)) {
+      // Adapters already plugged in are reported as arrivals right away.
+      const int registered = libusb_hotplug_register_callback(
+          context,
+          static_cast<libusb_hotplug_event>(
+              LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+              LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+          LIBUSB_HOTPLUG_ENUMERATE, VENDOR_ID, PRODUCT_ID,
+          LIBUSB_HOTPLUG_MATCH_ANY, &LibUSB::OnHotplug, this, &hotplugHandle);
+      if (registered == LIBUSB_SUCCESS) {
+        hotplug = true;
+      } else {
+        std::cout << "libusb_hotplug_register_callback failed: " << registered
+                  << std::endl;
+      }
     }
+    handlingEvents = true;
+    eventThread = std::thread([this]() { HandleEvents(); });
   }
-  ~ViGEmClient() {
-    vigem_disconnect(client);
-    vigem_free(client);
-  }
-  PVIGEM_TARGET AddController() {
-    // Allocate handle to identify new pad.
-    const PVIGEM_TARGET pad = vigem_target_ds4_alloc();
-    // Add client to the bus, this equals a plug-in event.
-    const VIGEM_ERROR add_err = vigem_target_add(client, pad);
-    if (!VIGEM_SUCCESS(add_err)) {
-      std::stringstream ss;
-      ss << "vigem_target_add failed with error code: 0x" << std::hex << add_err
-         << std::endl;
-      throw std::runtime_error(ss.str());
+  ~LibUSB() {
+    if (hotplug) {
+      libusb_hotplug_deregister_callback(context, hotplugHandle);
     }
-    const VIGEM_ERROR reg_err =
-        vigem_target_ds4_register_notification(client, pad, &UpdateRumble);
-    if (!VIGEM_SUCCESS(reg_err)) {
-      std::stringstream ss;
-      ss << "vigem_target_ds4_register_notification failed with error code: 0x"
-         << std::hex << reg_err << std::endl;
-      throw std::runtime_error(ss.str());
+    handlingEvents = false;
+    if (eventThread.joinable()) {
+      libusb_interrupt_event_handler(context);
+      eventThread.join();
+    }
+    // Adapters cancel their in-flight transfers on destruction, which needs a
+    // live context.
+    AdapterManager::Clear();
+    for (libusb_device* device : arrivals) {
+      libusb_unref_device(device);
+    }
+    for (libusb_device* device : departures) {
+      libusb_unref_device(device);
+    }
+    for (const PluggedAdapter& plugged : pluggedAdapters) {
+      libusb_unref_device(plugged.device);
     }
-    return pad;
-  }
-  void RemoveController(PVIGEM_TARGET& pad) {
-    vigem_target_ds4_unregister_notification(pad);
-    vigem_target_remove(client, pad);
-    vigem_target_free(pad);
-    pad = nullptr;
-  }
-  VIGEM_ERROR UpdateController(const PVIGEM_TARGET& pad,
-                               const DS4_REPORT& report) {
-    return vigem_target_ds4_update(client, pad, report);
-  }
-};
-
-class LibUSB {
-  // The vendor and product IDs associated with GameCube controller adapters.
-  // Any adapter placed in Wii U/Switch mode will appear with these IDs.
-  static const int VENDOR_ID = 0x57E;
-  static const int PRODUCT_ID = 0x337;
-
-  libusb_context* context = nullptr;
-
- public:
-  LibUSB() { libusb_init(&context); }
-  ~LibUSB() {
     if (context) {
       libusb_exit(context);
     }
   }
+  // Whether adapters are found through hotplug events instead of bus scans.
+  bool HasHotplug() const { return hotplug; }
+  // Opens adapters that arrived since the last call, and drops the ones that
+  // left. Without hotplug support, this scans the whole bus instead.
   void PollDevices() {
+    if (!context) {
+      return;
+    }
+    const auto now = std::chrono::steady_clock::now();
+    if (hotplug) {
+      std::vector<libusb_device*> arrived;
+      std::vector<libusb_device*> left;
+      {
+        std::lock_guard<std::mutex> lock(hotplugMutex);
+        arrived.swap(arrivals);
+        left.swap(departures);
+      }
+      for (libusb_device* device : left) {
+        // The reads fail soon anyway, but this skips waiting for them.
+        AdapterManager::ReadGuard guard;
+        for (size_t i = 0; i < AdapterManager::Size(); i++) {
+          auto usbAdapter =
+              dynamic_cast<LibUSBAdapter*>(AdapterManager::Get(i));
+          if (usbAdapter && usbAdapter->Device() == device) {
+            usbAdapter->MarkDisconnected();
+          }
+        }
+        pluggedAdapters.erase(
+            std::remove_if(pluggedAdapters.begin(), pluggedAdapters.end(),
+                           [device](const PluggedAdapter& plugged) {
+                             if (plugged.device != device) {
+                               return false;
+                             }
+                             libusb_unref_device(plugged.device);
+                             return true;
+                           }),
+            pluggedAdapters.end());
+        libusb_unref_device(device);
+      }
+      for (libusb_device* device : arrived) {
+        // The reference moves to pluggedAdapters.
+        pluggedAdapters.push_back({device, {}, false, {}});
+      }
+      // Open new adapters, ones another program held last time, and ones we
+      // dropped after their reads kept failing. No event reports the last
+      // kind, as the device never left.
+      for (PluggedAdapter& plugged : pluggedAdapters) {
+        if (!plugged.adapter.expired()) {
+          continue;
+        }
+        if (plugged.opened) {
+          plugged.opened = false;
+          plugged.retry.Failed(now);
+        }
+        if (!plugged.retry.Due(now)) {
+          continue;
+        }
+        plugged.adapter = OpenAdapter(plugged.device);
+        plugged.opened = !plugged.adapter.expired();
+        if (plugged.opened) {
+          plugged.retry = {};
+        } else {
+          plugged.retry.Failed(now);
+        }
+      }
+      return;
+    }
     libusb_device** list;
     // Hotplugging in Windows with libusb can only be done by getting the entire
     // device list, which is slow and should be done only infrequently.
     ssize_t num_devices = libusb_get_device_list(context, &list);
+    scanNumber++;
     for (ssize_t i = 0; i < num_devices; i++) {
       libusb_device* device = list[i];
-      libusb_device_descriptor desc;
-      int r = libusb_get_device_descriptor(device, &desc);
-      if (r < 0) {
+      // Devices seen on earlier scans are skipped without any descriptor reads
+      // or open attempts, unless they are adapters due another try.
+      const UsbLocation location = GetLocation(device);
+      KnownDevice& known = knownDevices[location];
+      const bool isNew = known.lastScan == 0;
+      known.lastScan = scanNumber;
+      if (!isNew && !(known.isAdapter && known.adapter.expired() &&
+                      known.retry.Due(now))) {
         continue;
       }
-      if (desc.idVendor == VENDOR_ID && desc.idProduct == PRODUCT_ID) {
-        libusb_device_handle* dev_handle = nullptr;
-        int retval = libusb_open(device, &dev_handle);
-        if (retval < 0) {
-          if (DEBUG) {
-            std::stringstream ss;
-            ss << "libusb_open failed with error code: " << retval << std::endl;
-            if (retval == LIBUSB_ERROR_ACCESS) {
-              ss << "A program (Dolphin, Yuzu, another feeder, etc.) has "
-                    "already claimed this adapter. Close it, then restart the "
-                    "feeder."
-                 << std::endl;
-            }
-            std::cout << ss.str();
-          }
+      if (isNew) {
+        libusb_device_descriptor desc;
+        int r = libusb_get_device_descriptor(device, &desc);
+        if (r < 0) {
+          // Possibly still enumerating. Look again on the next scan.
+          knownDevices.erase(location);
           continue;
         }
-        if (!dev_handle) {
-          std::stringstream ss;
-          ss << "libusb_open returned a nullptr dev_handle" << std::endl;
-          std::cout << ss.str();
+        known.isAdapter =
+            desc.idVendor == VENDOR_ID && desc.idProduct == PRODUCT_ID;
+        if (!known.isAdapter) {
           continue;
         }
-        std::shared_ptr<Adapter> adapterPtr =
-            std::make_shared<Adapter>(dev_handle);
-        AdapterManager::AddAdapter(adapterPtr);
+      }
+      // A new adapter, one we dropped after its reads kept failing, or one
+      // another program held last time.
+      known.adapter = OpenAdapter(device);
+      if (known.adapter.expired()) {
+        known.retry.Failed(now);
+      } else {
+        known.retry = {};
       }
     }
     libusb_free_device_list(list, 1);
-  }
-  static size_t NumAdapters() { return AdapterManager::AcquireRead()->size(); }
-};
-
-class AdapterThread {
- public:
-  // Take a ViGEmClient reference to share ownership.
-  AdapterThread(ViGEmClient& client) : vigemClient(client) {}
-
-  void SetupPads(
-      std::shared_ptr<const AdapterManager::AdapterList> adapters = nullptr) {
-    if (!adapters) {
-      adapters = AdapterManager::AcquireRead();
-    }
-    // Set up the virtual gamepads.
-    while (pads.size() / 4 < adapters->size()) {
-      for (size_t i = 0; i < 4; i++) {
-        pads.push_back(vigemClient.AddController());
-        // Initialize the inputs to nothing.
-        const Controller::GCInput resetGCInput;
-        const DS4_REPORT report = Controller::GCtoDS4(resetGCInput);
-        vigemClient.UpdateController(pads.back(), report);
-        // Initialize as disconnected, since we do not yet know if a controller
-        // is there.
-        isConnected.push_back(false);
+    // Forget unplugged devices. Their address changes if they come back.
+    for (auto it = knownDevices.begin(); it != knownDevices.end();) {
+      if (it->second.lastScan != scanNumber) {
+        it = knownDevices.erase(it);
+      } else {
+        ++it;
       }
     }
   }
-
-  size_t GetPadIndex(PVIGEM_TARGET pad) {
-    auto it = std::find(pads.begin(), pads.end(), pad);
-    if (it != pads.end()) {
-      return std::distance(pads.begin(), it);
-    } else {
-      return SIZE_MAX;
-    }
+  // Blocks until an adapter arrives or leaves, or the timeout expires.
+  void WaitForDevices(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(hotplugMutex);
+    hotplugEvents.wait_for(lock, timeout, [this] {
+      return !arrivals.empty() || !departures.empty();
+    });
   }
-
-  void run() {
-    while (running) {
-      // Grab a thread-safe snapshot of the array.
-      std::shared_ptr<const AdapterManager::AdapterList> adapters =
-          AdapterManager::AcquireRead();
-      // Allocate new virtual pads as needed.
-      SetupPads(adapters);
-
-      // Read inputs and update virtual gamepads.
-      for (size_t i = 0; i < adapters->size(); i++) {
-        Adapter* currentAdapter = (*adapters)[i].get();
-        // Missing adapters are skipped.
-        if (!currentAdapter) {
-          continue;
-        }
-        Adapter::Inputs inputs;
-        // If we fail to get the latest inputs, remove the lost adapter.
-        const bool gotLastInput = currentAdapter->GetInputs(inputs);
-        if (currentAdapter->ShouldDisconnect(gotLastInput)) {
-          AdapterManager::RemoveAdapter(currentAdapter);
-          // Associated pads are marked as disconnected.
-          // NOTE: This assumes inputs.Controllers[j].On() remains true.
-          for (size_t j = 0; j < 4; j++) {
-            size_t index = i * 4 + j;
-            isConnected[index] = false;
-          }
+  // Returns nullptr if the adapter could not be opened.
+  std::shared_ptr<Adapter> OpenAdapter(libusb_device* device) {
+    libusb_device_handle* dev_handle = nullptr;
+    int retval = libusb_open(device, &dev_handle);
+    if (retval < 0) {
+      if (DEBUG) {
+        std::stringstream ss;
+        ss << "libusb_open failed with error code: " << retval << std::endl;
+        if (retval == LIBUSB_ERROR_ACCESS) {
+          ss << "A program (Dolphin, Yuzu, another feeder, etc.) has "
+                "already claimed this adapter. It is picked up once that "
+                "program closes."
+             << std::endl;
         }
-        // Do not update the virtual gamepads if the adapter failed to report
-        // new inputs.
-        if (!gotLastInput) {
-          continue;
-        }
-        // Update the inputs of each virtual gamepad.
-        for (size_t j = 0; j < 4; j++) {
-          const size_t index = i * 4 + j;
-          Controller::GCInput& input = inputs.Controllers[j];
-          // Check for a connection change.
-          if (isConnected[index] != (bool)input.On()) {
-            isConnected[index] = (bool)input.On();
-            if (isConnected[index]) {
-              std::cout << "Controller " << index + 1 << " connected";
-              if (DEBUG) {
-                std::cout << " (" << std::bitset<8>(input.Status) << ")"
-                          << std::endl
-                          << "Wireless: "
-                          << (input.Wireless ? "Wireless" : "Wired")
-                          << std::endl
-                          << "Wireless Receive: "
-                          << (input.WirelessReceive ? "Yes" : "No") << std::endl
-                          << "Can Rumble: " << (input.CanRumble ? "Yes" : "No")
-                          << std::endl
-                          << "Console: " << (input.Console ? "GameCube" : "N64")
-                          << std::endl
-                          << "Wireless Type: "
-                          << (input.WirelessType ? "RF" : "IF") << std::endl
-                          << "Wireless State: "
-                          << (input.WirelessState ? "Fixed" : "Variable")
-                          << std::endl
-                          << "Standard: "
-                          << (input.Standard ? "Standard" : "Non-standard")
-                          << std::endl;
-              }
-              std::cout << std::endl;
-            } else {
-              // Disconnected controllers are reset.
-              const Controller::GCInput resetGCInput;
-              const DS4_REPORT report = Controller::GCtoDS4(resetGCInput);
-              vigemClient.UpdateController(pads[index], report);
-              std::cout << "Controller " << index + 1 << " disconnected"
-                        << std::endl;
-            }
-          }
-          if (!input.On()) {
-            continue;
-          }
-          if (pads.size() < index) {
-            throw std::out_of_range(
-                "Not enough virtual pads allocated to handle adapter inputs.");
-          }
-          DS4_REPORT report = Controller::GCtoDS4(input);
-          vigemClient.UpdateController(pads[index], report);
+        std::cout << ss.str();
+      }
+      return nullptr;
+    }
+    if (!dev_handle) {
+      std::stringstream ss;
+      ss << "libusb_open returned a nullptr dev_handle" << std::endl;
+      std::cout << ss.str();
+      return nullptr;
+    }
+    // Adapters return to the slot they had on this port before.
+    const std::string portPath = GetPortPath(device);
+    size_t slot = SIZE_MAX;
+    if (!portPath.empty()) {
+      std::vector<bool> occupied(AdapterManager::Size());
+      {
+        AdapterManager::ReadGuard guard;
+        for (size_t i = 0; i < occupied.size(); i++) {
+          occupied[i] = AdapterManager::Get(i) != nullptr;
         }
       }
+      slot = slotMap.SlotFor(portPath, occupied);
     }
-    // Tear down gamepads when the loop is over.
-    for (PVIGEM_TARGET& pad : pads) {
-      vigemClient.RemoveController(pad);
+    std::shared_ptr<Adapter> adapterPtr =
+        std::make_shared<LibUSBAdapter>(context, dev_handle);
+    if (!AdapterManager::AddAdapter(adapterPtr, slot)) {
+      return nullptr;
     }
+    return adapterPtr;
   }
-  // The list of virtual gamepads.
-  std::vector<PVIGEM_TARGET> pads;
-  // The ViGEmClient reference. Shared between adapters.
-  ViGEmClient& vigemClient;
-  // The controller connection state from the previous loop.
-  // Used to detect connection status changes.
-  // Corresponds directly to the pads vector.
-  std::vector<bool> isConnected;
+  static size_t NumAdapters() { return AdapterManager::Size(); }
 };
 
-_Function_class_(EVT_VIGEM_DS4_NOTIFICATION) VOID
-    UpdateRumble(PVIGEM_CLIENT Client, PVIGEM_TARGET Target, UCHAR LargeMotor,
-                 UCHAR SmallMotor, DS4_LIGHTBAR_COLOR LightbarColor) {
-  // Safely access AdapterThread via a static context pointer.
-  AdapterThread* thread = adapterThreadContext;
-  if (!thread) {
-    std::stringstream ss;
-    ss << "Missing adapterThreadContext" << std::endl;
-    throw std::runtime_error(ss.str());
-  }
+#ifdef _WIN32
+static const char* const DefaultSink = "vigem";
+#else
+static const char* const DefaultSink = "uinput";
+#endif
 
-  if (Client != thread->vigemClient.client) {
-    std::stringstream ss;
-    ss << "VIGEM_DS4_NOTIFICATION failed: "
-       << "client did not match." << std::endl;
-    throw std::runtime_error(ss.str());
+// Creates the virtual pad sink with the given name, or nullptr if the name is
+// unknown or unsupported on this platform.
+std::unique_ptr<VirtualPadSink> CreateSink(const std::string& name) {
+#ifdef _WIN32
+  if (name == "vigem") {
+    return std::make_unique<ViGEmSink>();
   }
-  // Identify the target controller.
-  size_t index = thread->GetPadIndex(Target);
-  if (index == SIZE_MAX) {
-    std::stringstream ss;
-    ss << "Could not find the requested vigemClient gamepad." << std::endl;
-    throw std::runtime_error(ss.str());
+#endif
+#ifdef __linux__
+  if (name == "uinput") {
+    return std::make_unique<UinputSink>();
   }
-
-  auto adapters = AdapterManager::AcquireRead();
-  size_t adapterIndex = index / 4;
-  if (adapterIndex < adapters->size()) {
-    Adapter* adapter = (*adapters)[adapterIndex].get();
-    if (adapter) {
-      bool motor = SmallMotor || LargeMotor;
-      adapter->SetRumble(index % 4, motor);
-    }
+#endif
+  if (name == "memory") {
+    return std::make_unique<MemoryPadSink>();
   }
+  return nullptr;
 }
 
 int main(int argc, char* argv[]) {
-  LibUSB libUsb;
-  ViGEmClient vigemClient;
-  AdapterThread adapterThread(vigemClient);
-  // Register the adapter thread context pointer.
-  adapterThreadContext = &adapterThread;
-
-  if (argc > 1) {
-    // TODO: Add a --prepopulate argument that accepts the number of adapters to
-    // pre-create as virtual controllers.
-    if (strcmp(argv[1], "--prepopulate") == 0) {
-      return 0;
+  std::string sinkName = DefaultSink;
+  // Simulated adapters to attach at startup, for load testing.
+  int numSimulated = 0;
+  SimulatedAdapter::Options simulatedOptions;
+  simulatedOptions.animateInputs = true;
+  // How often unchanged controller states are re-sent to the sink.
+  int keepAliveMs = 1000;
+  // Threads publishing adapter inputs to the sink.
+  int inputThreads = 1;
+  // Adapters to create virtual pads for up front.
+  int prepopulate = 0;
+  // Seconds between statistics summaries. 0 disables them.
+  int statsSeconds = 0;
+  std::string statsFile;
+  // How often the bus is scanned for adapters when hotplug events are not
+  // available.
+  int pollMs = 1000;
+  AdapterWritePolicy writePolicy;
+  // Where adapter slots are remembered by USB port. Empty to not remember.
+  std::string slotFile = "adapter_slots.txt";
+  // Where to record adapter traffic, and a recording to replay instead of
+  // using USB adapters.
+  std::string recordFile;
+  std::string replayFile;
+  double replaySpeed = 1;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--prepopulate") == 0 && i + 1 < argc &&
+        atoi(argv[i + 1]) > 0) {
+      prepopulate = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--sink") == 0 && i + 1 < argc) {
+      sinkName = argv[++i];
+    } else if (strcmp(argv[i], "--simulate") == 0 && i + 1 < argc &&
+               atoi(argv[i + 1]) > 0) {
+      numSimulated = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--simulate-rate") == 0 && i + 1 < argc &&
+               atoi(argv[i + 1]) > 0) {
+      simulatedOptions.pollRateHz = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--keepalive-ms") == 0 && i + 1 < argc &&
+               atoi(argv[i + 1]) >= 0) {
+      keepAliveMs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--input-threads") == 0 && i + 1 < argc &&
+               atoi(argv[i + 1]) > 0) {
+      inputThreads = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--poll-ms") == 0 && i + 1 < argc &&
+               atoi(argv[i + 1]) > 0) {
+      pollMs = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc &&
+               atoi(argv[i + 1]) > 0) {
+      statsSeconds = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--stats-file") == 0 && i + 1 < argc) {
+      statsFile = argv[++i];
+    } else if (strcmp(argv[i], "--slot-file") == 0 && i + 1 < argc) {
+      slotFile = argv[++i];
+    } else if (strcmp(argv[i], "--write-timeout-ms") == 0 && i + 1 < argc &&
+               atoi(argv[i + 1]) > 0) {
+      writePolicy.timeout = std::chrono::milliseconds(atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--write-retries") == 0 && i + 1 < argc &&
+               atoi(argv[i + 1]) >= 0) {
+      writePolicy.retries = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      recordFile = argv[++i];
+    } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replayFile = argv[++i];
+    } else if (strcmp(argv[i], "--replay-speed") == 0 && i + 1 < argc &&
+               atof(argv[i + 1]) >= 0) {
+      replaySpeed = atof(argv[++i]);
     } else {
-      std::cerr << "Usage: " << argv[0] << " [--prepopulate]" << std::endl;
+      std::cerr << "Usage: " << argv[0]
+                << " [--prepopulate ADAPTERS] [--sink vigem|uinput|memory]"
+                   " [--simulate ADAPTERS] [--simulate-rate HZ]"
+                   " [--keepalive-ms MS] [--input-threads N] [--poll-ms MS]"
+                   " [--stats SECONDS] [--stats-file PATH]"
+                   " [--write-timeout-ms MS] [--write-retries N]"
+                   " [--slot-file PATH] [--record PATH] [--replay PATH]"
+                   " [--replay-speed FACTOR]"
+                << std::endl;
       return 1;
     }
   }
 
+  if (DEBUG && !Controller::VerifyConversion()) {
+    std::cerr << "Controller conversion does not match the reference"
+              << std::endl;
+    return 1;
+  }
+
+  Adapter::writePolicy = writePolicy;
+  // Adapters record until they are destroyed, so the recorder outlives them.
+  std::unique_ptr<InputRecorder> recorder;
+  if (!recordFile.empty()) {
+    try {
+      recorder = std::make_unique<InputRecorder>(recordFile);
+    } catch (const std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+    Adapter::recorder = recorder.get();
+  }
+  // A replay stands in for USB adapters.
+  std::unique_ptr<LibUSB> libUsb;
+  if (replayFile.empty()) {
+    libUsb = std::make_unique<LibUSB>(slotFile);
+  }
+  std::unique_ptr<VirtualPadSink> sink = CreateSink(sinkName);
+  if (!sink) {
+    std::cerr << "Unsupported sink: " << sinkName << std::endl;
+    return 1;
+  }
+  AdapterThread adapterThread(*sink);
+  adapterThread.keepAliveInterval = std::chrono::milliseconds(keepAliveMs);
+  adapterThread.numWorkers = inputThreads;
+
+#ifdef _WIN32
   if (IsRunningAsAdmin()) {
     // Remove phantom DS4 devices before adding new ones, so Windows assigns
     // ports in a deterministic order.
@@ -657,31 +957,112 @@ int main(int argc, char* argv[]) {
                 << std::endl;
     }
   }
+#endif
+
+  for (int i = 0; i < numSimulated; i++) {
+    simulatedOptions.seed = i + 1;
+    auto adapter = std::make_shared<SimulatedAdapter>(simulatedOptions);
+    for (size_t port = 0; port < 4; port++) {
+      adapter->PlugController(port);
+    }
+    AdapterManager::AddAdapter(adapter);
+  }
+
+  std::unique_ptr<InputReplayer> replayer;
+  if (!replayFile.empty()) {
+    try {
+      replayer = std::make_unique<InputReplayer>(replayFile, replaySpeed);
+    } catch (const std::runtime_error& e) {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+  }
 
   std::cout << "Input feeder started" << std::endl;
 
   // Set a handler to gracefully close on Ctrl+C.
+#ifdef _WIN32
   SetConsoleCtrlHandler(CtrlHandler, TRUE);
+#else
+  signal(SIGINT, SignalHandler);
+  signal(SIGTERM, SignalHandler);
+#endif
 
   // Start the adapter thread to update inputs.
   // Multithreading ensures that polling for new adapters doesn't stall input
   // updates.
+  if (prepopulate > 0) {
+    const auto start = std::chrono::steady_clock::now();
+    adapterThread.ReservePads(prepopulate);
+    const auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start);
+    std::cout << "Created " << sink->NumPads() << " virtual pads in "
+              << elapsed.count() << " ms" << std::endl;
+  }
   adapterThread.SetupPads();
   std::thread thread([&adapterThread]() { adapterThread.run(); });
 
+  const bool hotplug = libUsb && libUsb->HasHotplug();
+  if (hotplug) {
+    std::cout << "Watching for adapters with hotplug events" << std::endl;
+  }
+  // With hotplug events, adapters are opened as soon as they arrive, and the
+  // wait only bounds how long shutdown takes to be noticed. Otherwise, only
+  // check for new controllers at a fixed interval. This prevents busy polling
+  // from maxing out a thread.
+  const std::chrono::milliseconds pollInterval(hotplug ? 1000 : pollMs);
+  // The stats file is refreshed every 10 seconds unless told otherwise.
+  StatsReporter statsReporter;
+  const std::chrono::seconds statsInterval(
+      statsSeconds > 0 ? statsSeconds : (statsFile.empty() ? 0 : 10));
+  auto nextStats = std::chrono::steady_clock::now() + statsInterval;
+  // Runs until Ctrl+C, or until a replay has played out.
   do {
-    libUsb.PollDevices();
-    // Only check for new controllers at a fixed interval.
-    // This prevents busy polling from maxing out a thread.
-    std::this_thread::sleep_for(std::chrono::milliseconds(5000));
-  } while (running);
+    if (libUsb) {
+      libUsb->PollDevices();
+    }
+    auto timeout = pollInterval;
+    if (statsInterval.count() > 0) {
+      timeout = std::min(
+          timeout, std::chrono::duration_cast<std::chrono::milliseconds>(
+                       nextStats - std::chrono::steady_clock::now()));
+    }
+    if (libUsb) {
+      libUsb->WaitForDevices(timeout);
+    } else {
+      std::this_thread::sleep_for(timeout);
+    }
+    if (statsInterval.count() > 0 &&
+        std::chrono::steady_clock::now() >= nextStats) {
+      nextStats += statsInterval;
+      if (statsSeconds > 0) {
+        statsReporter.PrintSummary(std::cout);
+      }
+      if (!statsFile.empty()) {
+        statsReporter.WriteSnapshot(statsFile);
+      }
+    }
+  } while (running && !(replayer && replayer->Finished()));
 
   // Wait for the adapter thread to finish gracefully.
+  adapterThread.Stop();
   if (thread.joinable()) {
     thread.join();
   }
-  // Clear context pointer before destructors.
-  adapterThreadContext = nullptr;
-
+  if (!statsFile.empty()) {
+    statsReporter.WriteSnapshot(statsFile);
+  }
+  replayer.reset();
+  libUsb.reset();
+  AdapterManager::Clear();
+  if (recorder) {
+    std::cout << "Recorded " << recorder->Records() << " records to "
+              << recordFile;
+    if (recorder->Dropped() > 0) {
+      std::cout << ", dropped " << recorder->Dropped();
+    }
+    std::cout << std::endl;
+    Adapter::recorder = nullptr;
+  }
   return 0;
 }
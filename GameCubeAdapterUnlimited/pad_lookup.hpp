@@ -0,0 +1,104 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+
+// Maps the handles a backend uses for its virtual pads back to pad indices,
+// for notifications that only identify the pad by handle. An open-addressed
+// hash table with linear probing, built as pads are created: lookups take no
+// locks and touch one or two slots.
+class PadLookup {
+ public:
+  static constexpr size_t Capacity = 512;
+
+  // Registers the handle of the pad at index. Add() and Remove() must only be
+  // called from one thread at a time.
+  void Add(const void* handle, size_t index) {
+    if (size >= Capacity) {
+      throw std::runtime_error("PadLookup is full");
+    }
+    // Every handle is registered once, so the first free slot will do.
+    size_t slot = Hash(handle);
+    while (true) {
+      const void* current = slots[slot].handle.load(std::memory_order_relaxed);
+      if (current == nullptr || current == Removed()) {
+        break;
+      }
+      slot = (slot + 1) & (NumSlots - 1);
+    }
+    slots[slot].index.store(index, std::memory_order_relaxed);
+    slots[slot].handle.store(handle, std::memory_order_release);
+    size++;
+  }
+  // Forgets a handle, before the backend frees it and may reuse its address.
+  // The slot is marked rather than emptied, so probe chains stay intact.
+  void Remove(const void* handle) {
+    const size_t slot = FindSlot(handle);
+    if (slot != SIZE_MAX) {
+      slots[slot].handle.store(Removed(), std::memory_order_release);
+      size--;
+    }
+  }
+
+  // Returns the index registered for handle, or SIZE_MAX. Safe to call from
+  // any thread, including while pads are being added.
+  size_t Find(const void* handle) const {
+    const size_t slot = FindSlot(handle);
+    if (slot == SIZE_MAX) {
+      return SIZE_MAX;
+    }
+    return slots[slot].index.load(std::memory_order_relaxed);
+  }
+
+ private:
+  // Twice the capacity, so probe chains stay short when full.
+  static constexpr size_t NumSlots = Capacity * 2;
+  static_assert((NumSlots & (NumSlots - 1)) == 0);
+  // log2(NumSlots).
+  static constexpr int SlotBits = [] {
+    int bits = 0;
+    while ((size_t(1) << bits) < NumSlots) {
+      bits++;
+    }
+    return bits;
+  }();
+
+  struct Slot {
+    std::atomic<const void*> handle = nullptr;
+    std::atomic<size_t> index = 0;
+  };
+
+  // Marks a slot whose handle was removed. Never a valid handle.
+  const void* Removed() const { return &slots; }
+
+  // Fibonacci hashing of the address, ignoring the alignment bits.
+  static size_t Hash(const void* handle) {
+    constexpr int Shift = 64 - SlotBits;
+    const uint64_t key = reinterpret_cast<uintptr_t>(handle) >> 4;
+    return static_cast<size_t>((key * 0x9E3779B97F4A7C15ull) >> Shift);
+  }
+
+  size_t FindSlot(const void* handle) const {
+    if (handle == nullptr) {
+      return SIZE_MAX;
+    }
+    size_t slot = Hash(handle);
+    for (size_t probes = 0; probes < NumSlots; probes++) {
+      const void* current = slots[slot].handle.load(std::memory_order_acquire);
+      if (current == handle) {
+        return slot;
+      }
+      if (current == nullptr) {
+        break;
+      }
+      slot = (slot + 1) & (NumSlots - 1);
+    }
+    return SIZE_MAX;
+  }
+
+  std::array<Slot, NumSlots> slots{};
+  // Live handles. Owned by the writer.
+  size_t size = 0;
+};
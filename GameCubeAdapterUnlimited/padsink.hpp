@@ -0,0 +1,114 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <stdexcept>
+
+#include "ds4_report.hpp"
+#include "frame_info.hpp"
+
+// A backend that presents virtual DualShock 4 pads to the host.
+// Pads are addressed by index, in the order they were added.
+class VirtualPadSink {
+ public:
+  // Invoked from a sink-owned thread when the host changes a pad's rumble.
+  using RumbleCallback = void (*)(void* context, size_t padIndex,
+                                  unsigned char largeMotor,
+                                  unsigned char smallMotor);
+
+  virtual ~VirtualPadSink() = default;
+
+  // Plugs in a new virtual pad and returns its index.
+  // Throws std::runtime_error on failure.
+  virtual size_t AddPad() = 0;
+  // Plugs in count pads with consecutive indices, and returns the first one.
+  // Backends that can create pads concurrently override this.
+  virtual size_t AddPads(size_t count) {
+    const size_t first = NumPads();
+    for (size_t i = 0; i < count; i++) {
+      AddPad();
+    }
+    return first;
+  }
+  // Unplugs the pad at index. The index is not reused.
+  virtual void RemovePad(size_t index) = 0;
+  // Sends a new input report for the pad at index, made from the given
+  // adapter frame.
+  // This is the hot path: implementations must not allocate. Distinct pads may
+  // be updated from different threads at once, and while pads are added.
+  virtual bool UpdatePad(size_t index, const DS4_REPORT& report,
+                         const FrameInfo& frame) = 0;
+  virtual size_t NumPads() const = 0;
+
+  // Must be set before any pad is added.
+  void SetRumbleCallback(RumbleCallback callback, void* context) {
+    rumbleCallback = callback;
+    rumbleContext = context;
+  }
+
+ protected:
+  void NotifyRumble(size_t padIndex, unsigned char largeMotor,
+                    unsigned char smallMotor) {
+    if (rumbleCallback) {
+      rumbleCallback(rumbleContext, padIndex, largeMotor, smallMotor);
+    }
+  }
+
+ private:
+  RumbleCallback rumbleCallback = nullptr;
+  void* rumbleContext = nullptr;
+};
+
+// Keeps the latest report of each pad in memory. Used for tests, load testing
+// and benchmarks, where no host-visible device is wanted.
+class MemoryPadSink : public VirtualPadSink {
+ public:
+  static constexpr size_t MaxPads = 512;
+
+  struct PadState {
+    DS4_REPORT report{};
+    // The frame the report was made from.
+    FrameInfo frame;
+    std::atomic<size_t> updates = 0;
+    bool attached = false;
+  };
+
+  size_t AddPad() override {
+    const size_t index = numPads.load(std::memory_order_relaxed);
+    if (index >= MaxPads) {
+      throw std::runtime_error("MemoryPadSink is out of pads");
+    }
+    pads[index].attached = true;
+    numPads.store(index + 1, std::memory_order_release);
+    return index;
+  }
+  void RemovePad(size_t index) override {
+    if (index < NumPads()) {
+      pads[index].attached = false;
+    }
+  }
+  bool UpdatePad(size_t index, const DS4_REPORT& report,
+                 const FrameInfo& frame) override {
+    if (index >= NumPads() || !pads[index].attached) {
+      return false;
+    }
+    pads[index].report = report;
+    pads[index].frame = frame;
+    pads[index].updates.fetch_add(1, std::memory_order_release);
+    return true;
+  }
+  size_t NumPads() const override {
+    return numPads.load(std::memory_order_acquire);
+  }
+
+  const PadState& GetPad(size_t index) const { return pads.at(index); }
+  // Plays the role of the host asking for rumble on a pad.
+  void SimulateRumble(size_t index, unsigned char largeMotor,
+                      unsigned char smallMotor) {
+    NotifyRumble(index, largeMotor, smallMotor);
+  }
+
+ private:
+  std::array<PadState, MaxPads> pads;
+  std::atomic<size_t> numPads = 0;
+};
@@ -0,0 +1,195 @@
+#include "simulated_adapter.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <thread>
+
+// Produces the frames of every simulated adapter from one thread. Adapters
+// that are due at the same time are handled in one pass, which signals the
+// input loop once.
+class SimulatedBus {
+ public:
+  static SimulatedBus& Get() {
+    // Never destroyed, so adapters outliving main() can still detach.
+    static SimulatedBus* bus = new SimulatedBus();
+    return *bus;
+  }
+
+  void Attach(SimulatedAdapter* adapter) {
+    std::lock_guard<std::mutex> lock(mutex);
+    adapters.push_back(adapter);
+    if (!running) {
+      // The previous thread, if any, stopped when the last adapter detached.
+      // Nothing joins the thread: once it clears running, it touches nothing
+      // else.
+      running = true;
+      std::thread([this]() { Run(); }).detach();
+    }
+    changed.notify_all();
+  }
+  // Once this returns, the bus no longer touches the adapter.
+  void Detach(SimulatedAdapter* adapter) {
+    std::lock_guard<std::mutex> lock(mutex);
+    adapters.erase(std::find(adapters.begin(), adapters.end(), adapter));
+    changed.notify_all();
+  }
+
+ private:
+  // Runs until no adapters are left.
+  void Run() {
+    using namespace std::chrono;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!adapters.empty()) {
+      steady_clock::time_point due = steady_clock::time_point::max();
+      for (SimulatedAdapter* adapter : adapters) {
+        due = std::min(due, adapter->Due());
+      }
+      // Woken early when adapters are attached or detached.
+      if (due == steady_clock::time_point::max()) {
+        changed.wait(lock);
+        continue;
+      }
+      if (steady_clock::now() < due) {
+        changed.wait_until(lock, due);
+        continue;
+      }
+      const steady_clock::time_point now = steady_clock::now();
+      FrameSignal::Batch batch(Adapter::newInputs);
+      for (SimulatedAdapter* adapter : adapters) {
+        if (adapter->Due() <= now) {
+          adapter->Tick(now);
+        }
+      }
+    }
+    running = false;
+  }
+
+  std::mutex mutex;
+  std::condition_variable changed;
+  std::vector<SimulatedAdapter*> adapters;
+  bool running = false;
+};
+
+SimulatedAdapter::SimulatedAdapter(const Options& options)
+    : options(options),
+      period(std::chrono::nanoseconds(std::chrono::seconds(1)) /
+             options.pollRateHz),
+      random(options.seed),
+      jitter(-std::chrono::nanoseconds(options.jitter).count(),
+             std::chrono::nanoseconds(options.jitter).count()) {
+  // Real adapters prefix each frame with report ID 0x21.
+  frame._pad[0] = 0x21;
+
+  // Initialize like a real adapter would be.
+  unsigned char init = 0x13;
+  Write(&init, 1);
+  ResetRumble();
+
+  const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+  // Adapters on one USB bus are polled on the same frame boundaries, so
+  // frames are scheduled on a grid shared by every adapter with this rate.
+  next = std::chrono::steady_clock::time_point(
+      (now.time_since_epoch() / period + 1) * period);
+  nextJitter = std::chrono::nanoseconds(jitter(random));
+  lastRead = now;
+  SimulatedBus::Get().Attach(this);
+}
+
+SimulatedAdapter::~SimulatedAdapter() { SimulatedBus::Get().Detach(this); }
+
+void SimulatedAdapter::PlugController(size_t port, unsigned char status) {
+  std::lock_guard<std::mutex> lock(stateMutex);
+  frame.Controllers[port].Status = status;
+}
+
+void SimulatedAdapter::UnplugController(size_t port) {
+  std::lock_guard<std::mutex> lock(stateMutex);
+  frame.Controllers[port] = Controller::GCInput();
+}
+
+void SimulatedAdapter::SetControllerInput(size_t port,
+                                          const Controller::GCInput& input) {
+  std::lock_guard<std::mutex> lock(stateMutex);
+  const unsigned char status = frame.Controllers[port].Status;
+  frame.Controllers[port] = input;
+  frame.Controllers[port].Status = status;
+}
+
+void SimulatedAdapter::Stall(std::chrono::milliseconds duration) {
+  std::lock_guard<std::mutex> lock(stateMutex);
+  stalledUntil = std::chrono::steady_clock::now() + duration;
+}
+
+void SimulatedAdapter::Disconnect() {
+  disconnected = true;
+  RecordDisconnect();
+}
+
+bool SimulatedAdapter::Write(unsigned char* data, int length) {
+  if (disconnected || length < 1) {
+    RecordFailedWrite();
+    return false;
+  }
+  RecordWrite();
+  if (data[0] == 0x13) {
+    polling = true;
+  } else if (data[0] == 0x11 && length == 5) {
+    const auto now = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(stateMutex);
+    rumbleWrites.push_back(
+        {{data[0], data[1], data[2], data[3], data[4]}, now});
+    numRumbleWrites = rumbleWrites.size();
+  }
+  return true;
+}
+
+std::vector<SimulatedAdapter::RumbleWrite> SimulatedAdapter::RumbleWrites() {
+  std::lock_guard<std::mutex> lock(stateMutex);
+  return rumbleWrites;
+}
+
+std::chrono::steady_clock::time_point SimulatedAdapter::Due() const {
+  if (disconnected) {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  return next + nextJitter;
+}
+
+void SimulatedAdapter::Tick(std::chrono::steady_clock::time_point now) {
+  using namespace std::chrono;
+  next += period;
+  nextJitter = nanoseconds(jitter(random));
+  if (!polling) {
+    return;
+  }
+  // Like a real adapter, take at most one rumble payload per frame.
+  FlushRumble();
+
+  Inputs inputs;
+  {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (now < stalledUntil) {
+      // A stalled adapter makes the host's pending reads time out.
+      if (now - lastRead >= milliseconds(ReadTimeoutMs)) {
+        lastRead = now;
+        RecordFailedRead();
+      }
+      return;
+    }
+    if (options.animateInputs) {
+      sweep++;
+      for (size_t port = 0; port < 4; port++) {
+        Controller::GCInput& controller = frame.Controllers[port];
+        if (controller.On()) {
+          controller.AnalogX = static_cast<unsigned char>(sweep + port * 64);
+          controller.CStickY = static_cast<unsigned char>(~controller.AnalogX);
+        }
+      }
+    }
+    inputs = frame;
+  }
+  lastRead = now;
+  PublishInputs(inputs);
+  framesSent++;
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <vector>
+
+#include "adapter.hpp"
+
+// An in-process stand-in for a USB adapter, for load testing without
+// hardware. Frames are produced at a fixed poll rate, and every payload
+// written to the adapter is recorded. Like a USB bus with a single event
+// thread, one thread produces the frames of every simulated adapter.
+class SimulatedAdapter : public Adapter {
+ public:
+  // Status bytes reported by real adapters for an attached controller.
+  static const unsigned char WiredStatus = 0x14;
+  static const unsigned char WiredNoRumbleStatus = 0x10;
+
+  struct Options {
+    // 125 Hz for a stock adapter, 1000 Hz for an overclocked one.
+    unsigned int pollRateHz = 125;
+    // Each frame is delayed or advanced by up to this much.
+    std::chrono::microseconds jitter{0};
+    // Sweep the analog sticks of attached controllers every frame, so that
+    // consecutive frames always differ. AnalogX carries an 8-bit frame counter,
+    // offset by 64 per port.
+    bool animateInputs = false;
+    uint32_t seed = 1;
+  };
+
+  SimulatedAdapter() : SimulatedAdapter(Options()) {}
+  explicit SimulatedAdapter(const Options& options);
+  ~SimulatedAdapter() override;
+
+  // Sets the Status byte of a port, as if a controller was attached.
+  void PlugController(size_t port, unsigned char status = WiredStatus);
+  void UnplugController(size_t port);
+  // Sets the buttons and axes reported for a port. The Status byte is kept.
+  void SetControllerInput(size_t port, const Controller::GCInput& input);
+  // Stops producing frames for a while. Pending reads time out meanwhile.
+  void Stall(std::chrono::milliseconds duration);
+  // Behaves like the adapter was unplugged: reads fail and writes are
+  // rejected from now on.
+  void Disconnect();
+
+  struct RumbleWrite {
+    std::array<unsigned char, 5> payload;
+    std::chrono::steady_clock::time_point time;
+  };
+
+  bool Write(unsigned char* data, int length) override;
+  // Every 0x11 rumble payload written so far, in order.
+  std::vector<RumbleWrite> RumbleWrites();
+  size_t NumRumbleWrites() const { return numRumbleWrites; }
+  // Frames published so far.
+  uint64_t FramesSent() const { return framesSent; }
+
+ private:
+  friend class SimulatedBus;
+
+  // Produces the frame that is due at now, and schedules the next one.
+  // Called from the bus thread.
+  void Tick(std::chrono::steady_clock::time_point now);
+  // When the next frame is due, or max() once the adapter is disconnected.
+  std::chrono::steady_clock::time_point Due() const;
+
+  const Options options;
+
+  // Frame schedule, owned by the bus thread. The next frame is due at next,
+  // shifted by its jitter.
+  const std::chrono::nanoseconds period;
+  std::minstd_rand random;
+  std::uniform_int_distribution<std::chrono::nanoseconds::rep> jitter;
+  std::chrono::steady_clock::time_point next;
+  std::chrono::nanoseconds nextJitter{0};
+  std::chrono::steady_clock::time_point lastRead;
+  unsigned char sweep = 0;
+
+  std::mutex stateMutex;
+  Inputs frame;
+  std::chrono::steady_clock::time_point stalledUntil;
+  std::vector<RumbleWrite> rumbleWrites;
+  std::atomic<size_t> numRumbleWrites = 0;
+
+  // Real adapters only start reporting after the 0x13 init payload.
+  std::atomic<bool> polling = false;
+  std::atomic<bool> disconnected = false;
+  std::atomic<uint64_t> framesSent = 0;
+};
@@ -0,0 +1,137 @@
+#include "slot_map.hpp"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <set>
+#include <sstream>
+
+SlotMap::SlotMap(std::string path, size_t maxSlots)
+    : path(std::move(path)), maxSlots(maxSlots) {
+  Load();
+}
+
+size_t SlotMap::SlotFor(const std::string& portPath,
+                        const std::vector<bool>& occupied) {
+  auto it = slots.find(portPath);
+  if (it != slots.end()) {
+    it->second.lastUse = ++useCount;
+    Save();
+    return it->second.slot;
+  }
+  std::set<size_t> claimed;
+  for (const auto& entry : slots) {
+    claimed.insert(entry.second.slot);
+  }
+  // A gap in the slot table that no port was given.
+  size_t slot = 0;
+  while (slot < occupied.size() && (occupied[slot] || claimed.count(slot))) {
+    slot++;
+  }
+  if (slot == occupied.size()) {
+    // A gap left by a port that is not in use now.
+    slot = EvictOldest(occupied, occupied.size());
+  }
+  if (slot == SIZE_MAX) {
+    // Grow the slot table.
+    slot = occupied.size();
+    while (slot < maxSlots && claimed.count(slot)) {
+      slot++;
+    }
+  }
+  if (slot >= maxSlots) {
+    slot = EvictOldest(occupied, maxSlots);
+  }
+  if (slot == SIZE_MAX) {
+    return SIZE_MAX;
+  }
+  slots[portPath] = {slot, ++useCount};
+  Save();
+  return slot;
+}
+
+size_t SlotMap::EvictOldest(const std::vector<bool>& occupied, size_t limit) {
+  auto oldest = slots.end();
+  for (auto it = slots.begin(); it != slots.end(); ++it) {
+    const size_t slot = it->second.slot;
+    if (slot >= limit || (slot < occupied.size() && occupied[slot])) {
+      continue;
+    }
+    if (oldest == slots.end() || it->second.lastUse < oldest->second.lastUse) {
+      oldest = it;
+    }
+  }
+  if (oldest == slots.end()) {
+    return SIZE_MAX;
+  }
+  const size_t slot = oldest->second.slot;
+  slots.erase(oldest);
+  return slot;
+}
+
+void SlotMap::Load() {
+  if (path.empty()) {
+    return;
+  }
+  std::ifstream in(path);
+  // No map yet. Created with the first adapter.
+  if (!in) {
+    return;
+  }
+  std::string line;
+  while (std::getline(in, line)) {
+    std::istringstream fields(line);
+    std::string portPath;
+    size_t slot;
+    // Slots are numbered from 1 in the file, like in the console messages.
+    if (!(fields >> portPath >> slot) || slot == 0 || slot > maxSlots) {
+      std::cout << "Ignoring malformed line in " << path << ": " << line
+                << std::endl;
+      continue;
+    }
+    // Later lines were used more recently, and win a slot given twice.
+    for (auto it = slots.begin(); it != slots.end(); ++it) {
+      if (it->second.slot == slot - 1) {
+        slots.erase(it);
+        break;
+      }
+    }
+    slots[portPath] = {slot - 1, ++useCount};
+  }
+}
+
+bool SlotMap::Save() const {
+  if (path.empty()) {
+    return true;
+  }
+  const std::string tempPath = path + ".tmp";
+  {
+    std::ofstream out(tempPath, std::ios::trunc);
+    if (!out) {
+      std::cout << "Failed to open " << tempPath << std::endl;
+      return false;
+    }
+    std::vector<std::pair<uint64_t, const std::string*>> order;
+    for (const auto& entry : slots) {
+      order.emplace_back(entry.second.lastUse, &entry.first);
+    }
+    std::sort(order.begin(), order.end());
+    for (const auto& entry : order) {
+      out << *entry.second << " " << slots.at(*entry.second).slot + 1
+          << std::endl;
+    }
+    if (!out) {
+      std::cout << "Failed to write " << tempPath << std::endl;
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tempPath, path, error);
+  if (error) {
+    std::cout << "Failed to replace " << path << ": " << error.message()
+              << std::endl;
+    return false;
+  }
+  return true;
+}
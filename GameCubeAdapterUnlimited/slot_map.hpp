@@ -0,0 +1,47 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Remembers which adapter slot each physical USB port was given, across
+// restarts, so that an adapter reattached to the same hub port gets the same
+// four virtual pads back. Kept in a small text file with one
+// "<port path> <slot>" line per port, least recently used first. Each slot
+// belongs to at most one port, so the map never outgrows the slot table. Only
+// used while adapters are being enumerated, never from the input loop.
+class SlotMap {
+ public:
+  // An empty path keeps the map in memory only. Slots are below maxSlots.
+  SlotMap(std::string path, size_t maxSlots);
+
+  // Returns the slot assigned to the port path. occupied has an entry for
+  // each slot in the slot table, set if an adapter is attached to it.
+  // A new port fills in a missing slot if there is one: a free slot no port
+  // was given, or else the free slot of the port used longest ago, which
+  // forgets its slot. Only then does it get a new slot, and once those run
+  // out, any free slot is taken over. Returns SIZE_MAX if every slot is
+  // occupied. Saves the map when it changes.
+  size_t SlotFor(const std::string& portPath,
+                 const std::vector<bool>& occupied);
+
+ private:
+  struct Entry {
+    size_t slot;
+    // Orders the ports by when they were last given their slot.
+    uint64_t lastUse;
+  };
+
+  void Load();
+  bool Save() const;
+  // Takes over the slot of the least recently used port whose slot is free
+  // and below limit. Returns SIZE_MAX if there is none.
+  size_t EvictOldest(const std::vector<bool>& occupied, size_t limit);
+
+  const std::string path;
+  const size_t maxSlots;
+  // Zero-based slots, by port path.
+  std::map<std::string, Entry> slots;
+  uint64_t useCount = 0;
+};
@@ -0,0 +1,147 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Records durations into log-linear buckets, HdrHistogram-style: 16 buckets per
+// power of two, so reported quantiles are within about 6% of the true value.
+// Fixed size and lock-free. Any thread may record at any time.
+class LatencyHistogram {
+ public:
+  static constexpr int SubBucketBits = 4;
+  static constexpr size_t SubBuckets = size_t(1) << SubBucketBits;
+  static constexpr size_t NumBuckets = (64 - SubBucketBits + 1) * SubBuckets;
+
+  // A consistent-enough copy of the counts, for reporting.
+  struct Snapshot {
+    std::array<uint64_t, NumBuckets> counts{};
+    uint64_t count = 0;
+    uint64_t sum = 0;
+    uint64_t max = 0;
+
+    // Returns an upper bound of the given quantile, in nanoseconds.
+    uint64_t Quantile(double quantile) const {
+      if (count == 0) {
+        return 0;
+      }
+      const uint64_t rank = std::max<uint64_t>(
+          1, static_cast<uint64_t>(quantile * static_cast<double>(count)));
+      uint64_t seen = 0;
+      for (size_t i = 0; i < NumBuckets; i++) {
+        seen += counts[i];
+        if (seen >= rank) {
+          return std::min(BucketUpperBound(i), max);
+        }
+      }
+      return max;
+    }
+    double Mean() const {
+      return count == 0 ? 0 : static_cast<double>(sum) / count;
+    }
+    // The samples recorded since an earlier snapshot. Its max is only known
+    // to bucket precision.
+    Snapshot Since(const Snapshot& earlier) const {
+      Snapshot delta = *this;
+      delta.max = 0;
+      for (size_t i = 0; i < NumBuckets; i++) {
+        delta.counts[i] -= std::min(delta.counts[i], earlier.counts[i]);
+        if (delta.counts[i] > 0) {
+          delta.max = std::min(BucketUpperBound(i), max);
+        }
+      }
+      delta.count -= std::min(count, earlier.count);
+      delta.sum -= std::min(sum, earlier.sum);
+      return delta;
+    }
+  };
+
+  void Record(std::chrono::nanoseconds duration) {
+    const uint64_t value =
+        static_cast<uint64_t>(std::max<int64_t>(0, duration.count()));
+    counts[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+    count.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+    uint64_t currentMax = max.load(std::memory_order_relaxed);
+    while (value > currentMax &&
+           !max.compare_exchange_weak(currentMax, value,
+                                      std::memory_order_relaxed)) {
+    }
+  }
+
+  Snapshot Take() const {
+    Snapshot snapshot;
+    for (size_t i = 0; i < NumBuckets; i++) {
+      snapshot.counts[i] = counts[i].load(std::memory_order_relaxed);
+    }
+    snapshot.count = count.load(std::memory_order_relaxed);
+    snapshot.sum = sum.load(std::memory_order_relaxed);
+    snapshot.max = max.load(std::memory_order_relaxed);
+    return snapshot;
+  }
+
+ private:
+  // Values below SubBuckets get a bucket each. Above that, the top
+  // SubBucketBits bits after the leading one pick the bucket.
+  static size_t BucketIndex(uint64_t value) {
+    if (value < SubBuckets) {
+      return static_cast<size_t>(value);
+    }
+    // Find the leading one, which is at least at bit SubBucketBits here.
+    int top = SubBucketBits;
+    while (top < 63 && value >> (top + 1)) {
+      top++;
+    }
+    const int shift = top - SubBucketBits;
+    const size_t subBucket = (value >> shift) & (SubBuckets - 1);
+    return (shift + 1) * SubBuckets + subBucket;
+  }
+  static uint64_t BucketUpperBound(size_t index) {
+    if (index < SubBuckets) {
+      return index;
+    }
+    const int shift = static_cast<int>(index / SubBuckets) - 1;
+    const uint64_t subBucket = index % SubBuckets;
+    return ((SubBuckets + subBucket + 1) << shift) - 1;
+  }
+
+  std::array<std::atomic<uint64_t>, NumBuckets> counts{};
+  std::atomic<uint64_t> count = 0;
+  std::atomic<uint64_t> sum = 0;
+  std::atomic<uint64_t> max = 0;
+};
+
+// Instrumentation kept by each adapter.
+struct AdapterStats {
+  // From submitting an interrupt read to its completion.
+  LatencyHistogram readLatency;
+  // Between the completions of consecutive frames, i.e. the real poll
+  // interval.
+  LatencyHistogram frameInterval;
+  // Time taken to write a rumble payload.
+  LatencyHistogram rumbleWrite;
+  std::atomic<uint64_t> frames = 0;
+  // Frames superseded by a newer one before the input loop got to them, and
+  // frames seen twice, going by their sequence numbers.
+  std::atomic<uint64_t> skippedFrames = 0;
+  std::atomic<uint64_t> repeatedFrames = 0;
+  // Every failed read, unlike the consecutive count used for disconnects.
+  std::atomic<uint64_t> failedReads = 0;
+  // Payloads given up after every attempt allowed by the write policy.
+  std::atomic<uint64_t> failedWrites = 0;
+};
+
+// Instrumentation for the feeder as a whole.
+struct FeederStats {
+  // Time taken by the sink to accept a pad update.
+  LatencyHistogram sinkUpdate;
+  // From a frame's transfer completing to the sink accepting the first
+  // report made from it.
+  LatencyHistogram inputLatency;
+  std::atomic<uint64_t> adapterConnects = 0;
+  std::atomic<uint64_t> adapterDisconnects = 0;
+};
+
+inline FeederStats g_feederStats;
@@ -0,0 +1,206 @@
+#include "stats_reporter.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace {
+
+// Formats nanoseconds as milliseconds.
+std::string Ms(uint64_t nanoseconds) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.2f", nanoseconds / 1e6);
+  return text;
+}
+
+// Formats nanoseconds as microseconds.
+std::string Us(uint64_t nanoseconds) {
+  char text[32];
+  snprintf(text, sizeof(text), "%.1f", nanoseconds / 1e3);
+  return text;
+}
+
+void WriteHistogram(std::ostream& out, const char* name,
+                    const LatencyHistogram::Snapshot& snapshot) {
+  out << "\"" << name << "\": {\"count\": " << snapshot.count
+      << ", \"mean\": " << static_cast<uint64_t>(snapshot.Mean())
+      << ", \"p50\": " << snapshot.Quantile(0.5)
+      << ", \"p90\": " << snapshot.Quantile(0.9)
+      << ", \"p99\": " << snapshot.Quantile(0.99)
+      << ", \"p999\": " << snapshot.Quantile(0.999)
+      << ", \"max\": " << snapshot.max << "}";
+}
+
+}  // namespace
+
+StatsReporter::StatsReporter()
+    : startTime(std::chrono::steady_clock::now()), previousTime(startTime) {}
+
+StatsReporter::AdapterSnapshots StatsReporter::TakeSnapshots(
+    const std::shared_ptr<Adapter>& adapter) {
+  AdapterSnapshots snapshots;
+  const AdapterStats& stats = adapter->Stats();
+  snapshots.adapter = adapter;
+  snapshots.frames = stats.frames.load(std::memory_order_relaxed);
+  snapshots.failedReads = stats.failedReads.load(std::memory_order_relaxed);
+  snapshots.failedWrites = stats.failedWrites.load(std::memory_order_relaxed);
+  snapshots.skippedFrames =
+      stats.skippedFrames.load(std::memory_order_relaxed);
+  snapshots.repeatedFrames =
+      stats.repeatedFrames.load(std::memory_order_relaxed);
+  snapshots.readLatency = stats.readLatency.Take();
+  snapshots.frameInterval = stats.frameInterval.Take();
+  snapshots.rumbleWrite = stats.rumbleWrite.Take();
+  return snapshots;
+}
+
+void StatsReporter::PrintSummary(std::ostream& out) {
+  const std::chrono::steady_clock::time_point now =
+      std::chrono::steady_clock::now();
+  const double seconds =
+      std::chrono::duration<double>(now - previousTime).count();
+  previousTime = now;
+
+  std::stringstream ss;
+  char header[64];
+  snprintf(header, sizeof(header), "Statistics for the last %.1f s:", seconds);
+  ss << header << std::endl;
+
+  const size_t numAdapters = AdapterManager::Size();
+  previousAdapters.resize(std::max(previousAdapters.size(), numAdapters));
+  for (size_t i = 0; i < numAdapters; i++) {
+    const std::shared_ptr<Adapter> adapter = AdapterManager::Share(i);
+    if (!adapter) {
+      continue;
+    }
+    AdapterSnapshots current = TakeSnapshots(adapter);
+    AdapterSnapshots& previous = previousAdapters[i];
+    if (previous.adapter.lock() != adapter) {
+      // A different adapter took the slot. Count from zero.
+      previous = AdapterSnapshots();
+    }
+    const LatencyHistogram::Snapshot interval =
+        current.frameInterval.Since(previous.frameInterval);
+    const LatencyHistogram::Snapshot read =
+        current.readLatency.Since(previous.readLatency);
+    const LatencyHistogram::Snapshot rumble =
+        current.rumbleWrite.Since(previous.rumbleWrite);
+    char rate[32];
+    snprintf(rate, sizeof(rate), "%.1f",
+             seconds > 0 ? (current.frames - previous.frames) / seconds : 0);
+
+    ss << "  Adapter " << i + 1 << ": " << rate << " Hz, frame interval p50 "
+       << Ms(interval.Quantile(0.5)) << " p99 " << Ms(interval.Quantile(0.99))
+       << " max " << Ms(interval.max) << " ms";
+    if (read.count > 0) {
+      ss << ", read p50 " << Ms(read.Quantile(0.5)) << " p99 "
+         << Ms(read.Quantile(0.99)) << " ms";
+    }
+    if (rumble.count > 0) {
+      ss << ", " << rumble.count << " rumble writes p99 "
+         << Ms(rumble.Quantile(0.99)) << " ms";
+    }
+    ss << ", " << current.failedReads - previous.failedReads
+       << " failed reads";
+    if (current.failedWrites != previous.failedWrites) {
+      ss << ", " << current.failedWrites - previous.failedWrites
+         << " failed writes";
+    }
+    if (current.skippedFrames != previous.skippedFrames) {
+      ss << ", " << current.skippedFrames - previous.skippedFrames
+         << " skipped frames";
+    }
+    if (current.repeatedFrames != previous.repeatedFrames) {
+      ss << ", " << current.repeatedFrames - previous.repeatedFrames
+         << " repeated frames";
+    }
+    ss << std::endl;
+    previous = std::move(current);
+  }
+
+  const LatencyHistogram::Snapshot sinkUpdate = g_feederStats.sinkUpdate.Take();
+  const LatencyHistogram::Snapshot updates =
+      sinkUpdate.Since(previousSinkUpdate);
+  ss << "  Sink: " << updates.count << " updates, p50 "
+     << Us(updates.Quantile(0.5)) << " p99 " << Us(updates.Quantile(0.99))
+     << " max " << Us(updates.max) << " us" << std::endl;
+  previousSinkUpdate = sinkUpdate;
+
+  const LatencyHistogram::Snapshot inputLatency =
+      g_feederStats.inputLatency.Take();
+  const LatencyHistogram::Snapshot inputs =
+      inputLatency.Since(previousInputLatency);
+  if (inputs.count > 0) {
+    ss << "  Input latency: p50 " << Us(inputs.Quantile(0.5)) << " p99 "
+       << Us(inputs.Quantile(0.99)) << " max " << Us(inputs.max) << " us"
+       << std::endl;
+  }
+  previousInputLatency = inputLatency;
+
+  const uint64_t connects = g_feederStats.adapterConnects;
+  const uint64_t disconnects = g_feederStats.adapterDisconnects;
+  ss << "  Adapters: " << connects - previousConnects << " connected, "
+     << disconnects - previousDisconnects << " disconnected" << std::endl;
+  previousConnects = connects;
+  previousDisconnects = disconnects;
+  out << ss.str();
+}
+
+bool StatsReporter::WriteSnapshot(const std::string& path) const {
+  const std::string tempPath = path + ".tmp";
+  {
+    std::ofstream out(tempPath, std::ios::trunc);
+    if (!out) {
+      std::cout << "Failed to open " << tempPath << std::endl;
+      return false;
+    }
+    const auto uptime = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - startTime);
+    out << "{\"uptime_ms\": " << uptime.count()
+        << ", \"adapter_connects\": " << g_feederStats.adapterConnects
+        << ", \"adapter_disconnects\": " << g_feederStats.adapterDisconnects
+        << ", ";
+    WriteHistogram(out, "sink_update_ns", g_feederStats.sinkUpdate.Take());
+    out << ", ";
+    WriteHistogram(out, "input_latency_ns", g_feederStats.inputLatency.Take());
+    out << ", \"adapters\": [";
+    const size_t numAdapters = AdapterManager::Size();
+    bool first = true;
+    for (size_t i = 0; i < numAdapters; i++) {
+      const std::shared_ptr<Adapter> adapter = AdapterManager::Share(i);
+      if (!adapter) {
+        continue;
+      }
+      const AdapterSnapshots snapshots = TakeSnapshots(adapter);
+      out << (first ? "" : ", ") << "{\"slot\": " << i + 1
+          << ", \"frames\": " << snapshots.frames
+          << ", \"failed_reads\": " << snapshots.failedReads
+          << ", \"failed_writes\": " << snapshots.failedWrites
+          << ", \"skipped_frames\": " << snapshots.skippedFrames
+          << ", \"repeated_frames\": " << snapshots.repeatedFrames << ", ";
+      WriteHistogram(out, "read_latency_ns", snapshots.readLatency);
+      out << ", ";
+      WriteHistogram(out, "frame_interval_ns", snapshots.frameInterval);
+      out << ", ";
+      WriteHistogram(out, "rumble_write_ns", snapshots.rumbleWrite);
+      out << "}";
+      first = false;
+    }
+    out << "]}" << std::endl;
+    if (!out) {
+      std::cout << "Failed to write " << tempPath << std::endl;
+      return false;
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(tempPath, path, error);
+  if (error) {
+    std::cout << "Failed to replace " << path << ": " << error.message()
+              << std::endl;
+    return false;
+  }
+  return true;
+}
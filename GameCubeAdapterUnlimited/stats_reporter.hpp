@@ -0,0 +1,47 @@
+#pragma once
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "adapter.hpp"
+#include "stats.hpp"
+
+// Presents the feeder's instrumentation, both as a console summary and as a
+// machine-readable snapshot file.
+class StatsReporter {
+ public:
+  StatsReporter();
+
+  // Prints what happened since the previous summary.
+  void PrintSummary(std::ostream& out);
+  // Writes the statistics gathered since startup as JSON. The file is replaced
+  // atomically, so readers never see a partial snapshot.
+  bool WriteSnapshot(const std::string& path) const;
+
+ private:
+  struct AdapterSnapshots {
+    std::weak_ptr<Adapter> adapter;
+    uint64_t frames = 0;
+    uint64_t failedReads = 0;
+    uint64_t failedWrites = 0;
+    uint64_t skippedFrames = 0;
+    uint64_t repeatedFrames = 0;
+    LatencyHistogram::Snapshot readLatency;
+    LatencyHistogram::Snapshot frameInterval;
+    LatencyHistogram::Snapshot rumbleWrite;
+  };
+  static AdapterSnapshots TakeSnapshots(
+      const std::shared_ptr<Adapter>& adapter);
+
+  const std::chrono::steady_clock::time_point startTime;
+  // State as of the previous summary. Adapters are indexed by slot.
+  std::chrono::steady_clock::time_point previousTime;
+  std::vector<AdapterSnapshots> previousAdapters;
+  LatencyHistogram::Snapshot previousSinkUpdate;
+  LatencyHistogram::Snapshot previousInputLatency;
+  uint64_t previousConnects = 0;
+  uint64_t previousDisconnects = 0;
+};
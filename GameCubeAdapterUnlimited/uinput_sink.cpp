@@ -0,0 +1,343 @@
+#ifdef __linux__
+#include "uinput_sink.hpp"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/uinput.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+namespace {
+
+// The IDs of a wired DualShock 4, so SDL and games apply their DS4 mappings.
+const unsigned short DS4VendorId = 0x054C;
+const unsigned short DS4ProductId = 0x05C4;
+
+struct KeyMapping {
+  unsigned short ds4Button;
+  unsigned short key;
+};
+const KeyMapping KeyMappings[] = {
+    {DS4_BUTTON_CROSS, BTN_SOUTH},
+    {DS4_BUTTON_CIRCLE, BTN_EAST},
+    {DS4_BUTTON_TRIANGLE, BTN_NORTH},
+    {DS4_BUTTON_SQUARE, BTN_WEST},
+    {DS4_BUTTON_SHOULDER_LEFT, BTN_TL},
+    {DS4_BUTTON_SHOULDER_RIGHT, BTN_TR},
+    {DS4_BUTTON_TRIGGER_LEFT, BTN_TL2},
+    {DS4_BUTTON_TRIGGER_RIGHT, BTN_TR2},
+    {DS4_BUTTON_SHARE, BTN_SELECT},
+    {DS4_BUTTON_OPTIONS, BTN_START},
+    {DS4_BUTTON_THUMB_LEFT, BTN_THUMBL},
+    {DS4_BUTTON_THUMB_RIGHT, BTN_THUMBR},
+};
+const size_t NumKeys = sizeof(KeyMappings) / sizeof(KeyMappings[0]);
+
+struct AxisSetup {
+  unsigned short code;
+  int minimum;
+  int maximum;
+  int initial;
+};
+const AxisSetup Axes[] = {
+    {ABS_X, 0, 255, 128},  {ABS_Y, 0, 255, 128},     {ABS_RX, 0, 255, 128},
+    {ABS_RY, 0, 255, 128}, {ABS_Z, 0, 255, 0},       {ABS_RZ, 0, 255, 0},
+    {ABS_HAT0X, -1, 1, 0}, {ABS_HAT0Y, -1, 1, 0},
+};
+const size_t NumAxes = sizeof(Axes) / sizeof(Axes[0]);
+
+// Hat axis values, indexed by DS4_DPAD_DIRECTIONS.
+struct HatValue {
+  signed char x;
+  signed char y;
+};
+const HatValue HatValues[16] = {
+    {0, -1}, {1, -1}, {1, 0},  {1, 1}, {0, 1},
+    {-1, 1}, {-1, 0}, {-1, -1}, {0, 0},
+};
+
+void Wake(int wakeFd) {
+  const uint64_t wake = 1;
+  if (write(wakeFd, &wake, sizeof(wake)) < 0) {
+    std::cout << "Failed to wake the force-feedback thread: "
+              << strerror(errno) << std::endl;
+  }
+}
+
+void SetEvent(input_event& event, unsigned short type, unsigned short code,
+              int value) {
+  event.type = type;
+  event.code = code;
+  event.value = value;
+}
+
+}  // namespace
+
+UinputSink::UinputSink() {
+  wakeFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wakeFd < 0) {
+    std::stringstream ss;
+    ss << "eventfd failed: " << strerror(errno) << std::endl;
+    throw std::runtime_error(ss.str());
+  }
+  handlingEvents = true;
+  ffRunning = true;
+  ffThread = std::thread([this]() {
+    HandleForceFeedback();
+    {
+      std::lock_guard<std::mutex> lock(padsMutex);
+      ffRunning = false;
+    }
+    pollRebuilt.notify_all();
+  });
+}
+
+UinputSink::~UinputSink() {
+  handlingEvents = false;
+  Wake(wakeFd);
+  if (ffThread.joinable()) {
+    ffThread.join();
+  }
+  for (size_t i = 0; i < NumPads(); i++) {
+    RemovePad(i);
+  }
+  close(wakeFd);
+}
+
+size_t UinputSink::AddPad() {
+  std::lock_guard<std::mutex> lock(padsMutex);
+  const size_t index = numPads.load(std::memory_order_relaxed);
+  if (index >= MaxPads) {
+    throw std::runtime_error("Too many uinput pads");
+  }
+
+  const int fd = open("/dev/uinput", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+  if (fd < 0) {
+    std::stringstream ss;
+    ss << "Failed to open /dev/uinput: " << strerror(errno) << std::endl;
+    throw std::runtime_error(ss.str());
+  }
+  auto check = [fd](int result, const char* what) {
+    if (result < 0) {
+      std::stringstream ss;
+      ss << what << " failed: " << strerror(errno) << std::endl;
+      close(fd);
+      throw std::runtime_error(ss.str());
+    }
+  };
+
+  check(ioctl(fd, UI_SET_EVBIT, EV_KEY), "UI_SET_EVBIT EV_KEY");
+  for (const KeyMapping& mapping : KeyMappings) {
+    check(ioctl(fd, UI_SET_KEYBIT, mapping.key), "UI_SET_KEYBIT");
+  }
+  check(ioctl(fd, UI_SET_EVBIT, EV_ABS), "UI_SET_EVBIT EV_ABS");
+  for (const AxisSetup& axis : Axes) {
+    check(ioctl(fd, UI_SET_ABSBIT, axis.code), "UI_SET_ABSBIT");
+    uinput_abs_setup absSetup{};
+    absSetup.code = axis.code;
+    absSetup.absinfo.minimum = axis.minimum;
+    absSetup.absinfo.maximum = axis.maximum;
+    absSetup.absinfo.value = axis.initial;
+    check(ioctl(fd, UI_ABS_SETUP, &absSetup), "UI_ABS_SETUP");
+  }
+  check(ioctl(fd, UI_SET_EVBIT, EV_FF), "UI_SET_EVBIT EV_FF");
+  check(ioctl(fd, UI_SET_FFBIT, FF_RUMBLE), "UI_SET_FFBIT");
+
+  uinput_setup setup{};
+  setup.id.bustype = BUS_USB;
+  setup.id.vendor = DS4VendorId;
+  setup.id.product = DS4ProductId;
+  setup.id.version = 1;
+  snprintf(setup.name, sizeof(setup.name), "GameCube Adapter Unlimited Pad %zu",
+           index + 1);
+  setup.ff_effects_max = MaxEffects;
+  check(ioctl(fd, UI_DEV_SETUP, &setup), "UI_DEV_SETUP");
+  check(ioctl(fd, UI_DEV_CREATE), "UI_DEV_CREATE");
+
+  pads[index].effects = {};
+  pads[index].fd.store(fd, std::memory_order_relaxed);
+  numPads.store(index + 1, std::memory_order_release);
+
+  // Have the force-feedback thread start watching the new pad.
+  Wake(wakeFd);
+  return index;
+}
+
+void UinputSink::RemovePad(size_t index) {
+  std::unique_lock<std::mutex> lock(padsMutex);
+  if (index >= NumPads()) {
+    return;
+  }
+  Pad& pad = pads[index];
+  int fd;
+  {
+    // Waits out a write that already loaded the fd.
+    std::lock_guard<std::mutex> writeLock(pad.writeMutex);
+    fd = pad.fd.exchange(-1);
+  }
+  if (fd < 0) {
+    return;
+  }
+  // The fd number may be reused once closed, so the force-feedback thread
+  // must stop polling it first.
+  const uint64_t generation = pollGeneration;
+  Wake(wakeFd);
+  pollRebuilt.wait(lock, [this, generation] {
+    return pollGeneration != generation || !ffRunning;
+  });
+  ioctl(fd, UI_DEV_DESTROY);
+  close(fd);
+}
+
+bool UinputSink::UpdatePad(size_t index, const DS4_REPORT& report,
+                           const FrameInfo& /*frame*/) {
+  if (index >= NumPads()) {
+    return false;
+  }
+  Pad& pad = pads[index];
+  // Uncontended unless the pad is being removed.
+  std::lock_guard<std::mutex> writeLock(pad.writeMutex);
+  const int fd = pad.fd.load(std::memory_order_relaxed);
+  if (fd < 0) {
+    return false;
+  }
+
+  // The whole report goes out in a single write. The input core drops values
+  // that did not change, so every axis and key is sent each time.
+  input_event events[NumAxes + NumKeys + 1]{};
+  size_t n = 0;
+  SetEvent(events[n++], EV_ABS, ABS_X, report.bThumbLX);
+  SetEvent(events[n++], EV_ABS, ABS_Y, report.bThumbLY);
+  SetEvent(events[n++], EV_ABS, ABS_RX, report.bThumbRX);
+  SetEvent(events[n++], EV_ABS, ABS_RY, report.bThumbRY);
+  SetEvent(events[n++], EV_ABS, ABS_Z, report.bTriggerL);
+  SetEvent(events[n++], EV_ABS, ABS_RZ, report.bTriggerR);
+  const HatValue& hat = HatValues[report.wButtons & 0xF];
+  SetEvent(events[n++], EV_ABS, ABS_HAT0X, hat.x);
+  SetEvent(events[n++], EV_ABS, ABS_HAT0Y, hat.y);
+  for (const KeyMapping& mapping : KeyMappings) {
+    SetEvent(events[n++], EV_KEY, mapping.key,
+             (report.wButtons & mapping.ds4Button) != 0);
+  }
+  SetEvent(events[n++], EV_SYN, SYN_REPORT, 0);
+
+  const ssize_t size = static_cast<ssize_t>(n * sizeof(input_event));
+  return write(fd, events, size) == size;
+}
+
+void UinputSink::HandleForceFeedback() {
+  // Rebuilt only when pads are added or removed, never on the input path.
+  std::vector<pollfd> fds;
+  std::vector<size_t> fdPads;
+  while (handlingEvents) {
+    fds.clear();
+    fdPads.clear();
+    fds.push_back({wakeFd, POLLIN, 0});
+    {
+      std::lock_guard<std::mutex> lock(padsMutex);
+      for (size_t i = 0; i < NumPads(); i++) {
+        const int fd = pads[i].fd.load(std::memory_order_relaxed);
+        if (fd >= 0) {
+          fds.push_back({fd, POLLIN, 0});
+          fdPads.push_back(i);
+        }
+      }
+      pollGeneration++;
+    }
+    pollRebuilt.notify_all();
+
+    bool rebuild = false;
+    while (handlingEvents && !rebuild) {
+      if (poll(fds.data(), fds.size(), -1) < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        std::cout << "poll failed: " << strerror(errno) << std::endl;
+        return;
+      }
+      if (fds[0].revents & POLLIN) {
+        uint64_t wake;
+        rebuild = read(wakeFd, &wake, sizeof(wake)) == sizeof(wake);
+      }
+      for (size_t i = 1; i < fds.size(); i++) {
+        if (fds[i].revents & (POLLERR | POLLHUP | POLLNVAL)) {
+          // Stop watching a broken pad. Negative fds are ignored by poll().
+          fds[i].fd = -1;
+        } else if (fds[i].revents & POLLIN) {
+          ReadEvents(fdPads[i - 1]);
+        }
+      }
+    }
+  }
+}
+
+void UinputSink::ReadEvents(size_t index) {
+  std::lock_guard<std::mutex> lock(padsMutex);
+  Pad& pad = pads[index];
+  const int fd = pad.fd.load(std::memory_order_relaxed);
+  if (fd < 0) {
+    return;
+  }
+
+  input_event event;
+  while (read(fd, &event, sizeof(event)) == sizeof(event)) {
+    if (event.type == EV_UINPUT && event.code == UI_FF_UPLOAD) {
+      uinput_ff_upload upload{};
+      upload.request_id = event.value;
+      if (ioctl(fd, UI_BEGIN_FF_UPLOAD, &upload) < 0) {
+        continue;
+      }
+      const ff_effect& effect = upload.effect;
+      if (effect.type == FF_RUMBLE && effect.id >= 0 &&
+          static_cast<size_t>(effect.id) < MaxEffects) {
+        Effect& slot = pad.effects[effect.id];
+        slot.strong = effect.u.rumble.strong_magnitude;
+        slot.weak = effect.u.rumble.weak_magnitude;
+        upload.retval = 0;
+      } else {
+        upload.retval = -EINVAL;
+      }
+      ioctl(fd, UI_END_FF_UPLOAD, &upload);
+      // Re-uploading a playing effect changes its strength immediately.
+      ApplyRumble(index);
+    } else if (event.type == EV_UINPUT && event.code == UI_FF_ERASE) {
+      uinput_ff_erase erase{};
+      erase.request_id = event.value;
+      if (ioctl(fd, UI_BEGIN_FF_ERASE, &erase) < 0) {
+        continue;
+      }
+      if (erase.effect_id < MaxEffects) {
+        pad.effects[erase.effect_id] = {};
+      }
+      erase.retval = 0;
+      ioctl(fd, UI_END_FF_ERASE, &erase);
+      ApplyRumble(index);
+    } else if (event.type == EV_FF && event.code < MaxEffects) {
+      pad.effects[event.code].playing = event.value != 0;
+      ApplyRumble(index);
+    }
+  }
+}
+
+void UinputSink::ApplyRumble(size_t index) {
+  unsigned short strong = 0;
+  unsigned short weak = 0;
+  for (const Effect& effect : pads[index].effects) {
+    if (effect.playing) {
+      strong = std::max(strong, effect.strong);
+      weak = std::max(weak, effect.weak);
+    }
+  }
+  NotifyRumble(index, strong >> 8, weak >> 8);
+}
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "padsink.hpp"
+
+// Presents pads as DualShock 4-style evdev devices through /dev/uinput, using
+// the button and axis layout of the kernel's hid-playstation driver.
+// Rumble requests arrive as force-feedback effects.
+class UinputSink : public VirtualPadSink {
+ public:
+  static constexpr size_t MaxPads = 512;
+
+  UinputSink();
+  ~UinputSink();
+
+  size_t AddPad() override;
+  void RemovePad(size_t index) override;
+  bool UpdatePad(size_t index, const DS4_REPORT& report,
+                 const FrameInfo& frame) override;
+  size_t NumPads() const override {
+    return numPads.load(std::memory_order_acquire);
+  }
+
+ private:
+  // Force-feedback effect slots per pad. Only FF_RUMBLE is supported.
+  static constexpr size_t MaxEffects = 16;
+
+  struct Effect {
+    unsigned short strong = 0;
+    unsigned short weak = 0;
+    bool playing = false;
+  };
+  struct Pad {
+    std::atomic<int> fd = -1;
+    // Held while writing to fd, so RemovePad() can wait out a write.
+    std::mutex writeMutex;
+    std::array<Effect, MaxEffects> effects{};
+  };
+
+  // Services force-feedback uploads and playback for every pad.
+  void HandleForceFeedback();
+  void ReadEvents(size_t index);
+  // Reports the combined strength of the playing effects.
+  void ApplyRumble(size_t index);
+
+  std::array<Pad, MaxPads> pads;
+  std::atomic<size_t> numPads = 0;
+  // Serializes pad creation and removal against the force-feedback thread.
+  std::mutex padsMutex;
+  // Wakes the force-feedback thread when pads change or on shutdown.
+  int wakeFd = -1;
+  std::atomic<bool> handlingEvents = false;
+  // Counts the force-feedback thread's poll set rebuilds, so RemovePad() can
+  // wait until a removed pad is no longer polled. Guarded by padsMutex.
+  uint64_t pollGeneration = 0;
+  bool ffRunning = false;
+  std::condition_variable pollRebuilt;
+  std::thread ffThread;
+};
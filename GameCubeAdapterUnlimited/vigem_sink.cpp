@@ -0,0 +1,219 @@
+#ifdef _WIN32
+#include "vigem_sink.hpp"
+
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+ViGEmSink::ViGEmSink() {
+  client = vigem_alloc();
+  if (!client) {
+    throw std::runtime_error("vigem_alloc failed");
+  }
+  const VIGEM_ERROR retval = vigem_connect(client);
+  if (!VIGEM_SUCCESS(retval)) {
+    std::stringstream ss;
+    ss << "vigem_connect failed with error code: 0x" << std::hex << retval
+       << std::endl;
+    throw std::runtime_error(ss.str());
+  }
+  instance = this;
+}
+
+ViGEmSink::~ViGEmSink() {
+  for (size_t i = 0; i < NumPads(); i++) {
+    RemovePad(i);
+  }
+  instance = nullptr;
+  vigem_disconnect(client);
+  vigem_free(client);
+}
+
+size_t ViGEmSink::AddPad() {
+  const size_t index = numPads.load(std::memory_order_relaxed);
+  if (index >= MaxPads) {
+    throw std::runtime_error("Too many ViGEm pads");
+  }
+  // Allocate handle to identify new pad.
+  const PVIGEM_TARGET pad = vigem_target_ds4_alloc();
+  // Add client to the bus, this equals a plug-in event.
+  const VIGEM_ERROR add_err = vigem_target_add(client, pad);
+  if (!VIGEM_SUCCESS(add_err)) {
+    vigem_target_free(pad);
+    std::stringstream ss;
+    ss << "vigem_target_add failed with error code: 0x" << std::hex << add_err
+       << std::endl;
+    throw std::runtime_error(ss.str());
+  }
+  const VIGEM_ERROR reg_err = StorePad(index, pad);
+  if (!VIGEM_SUCCESS(reg_err)) {
+    vigem_target_remove(client, pad);
+    vigem_target_free(pad);
+    ThrowRegisterError(reg_err);
+  }
+  numPads.store(index + 1, std::memory_order_release);
+  return index;
+}
+
+size_t ViGEmSink::AddPads(size_t count) {
+  const size_t first = numPads.load(std::memory_order_relaxed);
+  if (first + count > MaxPads) {
+    throw std::runtime_error("Too many ViGEm pads");
+  }
+  // Every vigem_target_add_async call plugs in its pad from its own thread.
+  std::vector<PVIGEM_TARGET> added(count);
+  {
+    std::lock_guard<std::mutex> lock(addMutex);
+    pendingAdds = count;
+    addError = VIGEM_ERROR_NONE;
+    pluggedIn.clear();
+    pluggedIn.reserve(count);
+  }
+  for (PVIGEM_TARGET& pad : added) {
+    pad = vigem_target_ds4_alloc();
+    const VIGEM_ERROR add_err =
+        vigem_target_add_async(client, pad, &OnPadAdded);
+    if (!VIGEM_SUCCESS(add_err)) {
+      OnPadAdded(client, pad, add_err);
+    }
+  }
+  {
+    std::unique_lock<std::mutex> lock(addMutex);
+    addDone.wait(lock, [this] { return pendingAdds == 0; });
+  }
+  if (!VIGEM_SUCCESS(addError)) {
+    // Only unplug the pads whose add went through.
+    for (PVIGEM_TARGET pad : added) {
+      if (std::find(pluggedIn.begin(), pluggedIn.end(), pad) !=
+          pluggedIn.end()) {
+        vigem_target_remove(client, pad);
+      }
+      vigem_target_free(pad);
+    }
+    std::stringstream ss;
+    ss << "vigem_target_add_async failed with error code: 0x" << std::hex
+       << addError << std::endl;
+    throw std::runtime_error(ss.str());
+  }
+
+  // The pads raced for serial numbers, which decide the order the host sees
+  // them in. Sorting keeps indices in that order.
+  std::sort(added.begin(), added.end(), [](PVIGEM_TARGET a, PVIGEM_TARGET b) {
+    return vigem_target_get_index(a) < vigem_target_get_index(b);
+  });
+  for (size_t i = 0; i < count; i++) {
+    const VIGEM_ERROR reg_err = StorePad(first + i, added[i]);
+    if (!VIGEM_SUCCESS(reg_err)) {
+      // None of the batch is published yet, so all of it can be unplugged.
+      for (size_t j = 0; j < count; j++) {
+        if (j < i) {
+          ForgetPad(first + j);
+        }
+        vigem_target_remove(client, added[j]);
+        vigem_target_free(added[j]);
+      }
+      ThrowRegisterError(reg_err);
+    }
+  }
+  numPads.store(first + count, std::memory_order_release);
+  return first;
+}
+
+VIGEM_ERROR ViGEmSink::StorePad(size_t index, PVIGEM_TARGET pad) {
+  pads[index] = pad;
+  padLookup.Add(pad, index);
+  const VIGEM_ERROR reg_err =
+      vigem_target_ds4_register_notification(client, pad, &OnNotification);
+  if (!VIGEM_SUCCESS(reg_err)) {
+    padLookup.Remove(pad);
+    pads[index] = nullptr;
+  }
+  return reg_err;
+}
+
+void ViGEmSink::ForgetPad(size_t index) {
+  PVIGEM_TARGET& pad = pads[index];
+  vigem_target_ds4_unregister_notification(pad);
+  padLookup.Remove(pad);
+  pad = nullptr;
+}
+
+void ViGEmSink::ThrowRegisterError(VIGEM_ERROR error) {
+  std::stringstream ss;
+  ss << "vigem_target_ds4_register_notification failed with error code: 0x"
+     << std::hex << error << std::endl;
+  throw std::runtime_error(ss.str());
+}
+
+_Function_class_(EVT_VIGEM_TARGET_ADD_RESULT) VOID
+    ViGEmSink::OnPadAdded(PVIGEM_CLIENT Client, PVIGEM_TARGET Target,
+                          VIGEM_ERROR Result) {
+  ViGEmSink* sink = instance;
+  if (!sink) {
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(sink->addMutex);
+    if (VIGEM_SUCCESS(Result)) {
+      sink->pluggedIn.push_back(Target);
+    } else {
+      sink->addError = Result;
+    }
+    sink->pendingAdds--;
+  }
+  sink->addDone.notify_all();
+}
+
+void ViGEmSink::RemovePad(size_t index) {
+  if (index >= NumPads()) {
+    return;
+  }
+  const PVIGEM_TARGET pad = pads[index];
+  if (!pad) {
+    return;
+  }
+  ForgetPad(index);
+  vigem_target_remove(client, pad);
+  vigem_target_free(pad);
+}
+
+bool ViGEmSink::UpdatePad(size_t index, const DS4_REPORT& report,
+                          const FrameInfo& /*frame*/) {
+  if (index >= NumPads()) {
+    return false;
+  }
+  const PVIGEM_TARGET pad = pads[index];
+  if (!pad) {
+    return false;
+  }
+  return VIGEM_SUCCESS(vigem_target_ds4_update(client, pad, report));
+}
+
+_Function_class_(EVT_VIGEM_DS4_NOTIFICATION) VOID
+    ViGEmSink::OnNotification(PVIGEM_CLIENT Client, PVIGEM_TARGET Target,
+                              UCHAR LargeMotor, UCHAR SmallMotor,
+                              DS4_LIGHTBAR_COLOR LightbarColor) {
+  ViGEmSink* sink = instance;
+  if (!sink) {
+    std::stringstream ss;
+    ss << "Missing ViGEmSink instance" << std::endl;
+    throw std::runtime_error(ss.str());
+  }
+
+  if (Client != sink->client) {
+    std::stringstream ss;
+    ss << "VIGEM_DS4_NOTIFICATION failed: "
+       << "client did not match." << std::endl;
+    throw std::runtime_error(ss.str());
+  }
+  // Identify the target controller.
+  size_t index = sink->padLookup.Find(Target);
+  if (index == SIZE_MAX) {
+    std::stringstream ss;
+    ss << "Could not find the requested vigemClient gamepad." << std::endl;
+    throw std::runtime_error(ss.str());
+  }
+  sink->NotifyRumble(index, LargeMotor, SmallMotor);
+}
+#endif
@@ -0,0 +1,69 @@
+#pragma once
+#include <windows.h>
+// Windows header must be defined before these to prevent build errors.
+#include <ViGEm/Client.h>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+#include "pad_lookup.hpp"
+#include "padsink.hpp"
+
+// Presents pads as DualShock 4 controllers through the ViGEm bus driver.
+class ViGEmSink : public VirtualPadSink {
+ public:
+  static constexpr size_t MaxPads = 512;
+
+  ViGEmSink();
+  ~ViGEmSink();
+
+  size_t AddPad() override;
+  // Plugs in all pads at once. The host still sees them in index order.
+  size_t AddPads(size_t count) override;
+  void RemovePad(size_t index) override;
+  bool UpdatePad(size_t index, const DS4_REPORT& report,
+                 const FrameInfo& frame) override;
+  size_t NumPads() const override {
+    return numPads.load(std::memory_order_acquire);
+  }
+
+ private:
+  static _Function_class_(EVT_VIGEM_DS4_NOTIFICATION) VOID
+      OnNotification(PVIGEM_CLIENT Client, PVIGEM_TARGET Target,
+                     UCHAR LargeMotor, UCHAR SmallMotor,
+                     DS4_LIGHTBAR_COLOR LightbarColor);
+
+  static _Function_class_(EVT_VIGEM_TARGET_ADD_RESULT) VOID
+      OnPadAdded(PVIGEM_CLIENT Client, PVIGEM_TARGET Target,
+                 VIGEM_ERROR Result);
+
+  // Stores an added pad at index and registers for its notifications. The
+  // caller publishes it by raising numPads once this succeeds.
+  VIGEM_ERROR StorePad(size_t index, PVIGEM_TARGET pad);
+  // Undoes StorePad(). The pad stays plugged in.
+  void ForgetPad(size_t index);
+  [[noreturn]] static void ThrowRegisterError(VIGEM_ERROR error);
+
+  // ViGEm notifications carry no user context, so the sink is found through
+  // this pointer. Only one ViGEmSink may exist at a time.
+  static inline ViGEmSink* instance = nullptr;
+
+  PVIGEM_CLIENT client;
+  // The virtual gamepads. Fixed in place, so pads can be added while others
+  // are being updated.
+  std::array<PVIGEM_TARGET, MaxPads> pads{};
+  std::atomic<size_t> numPads = 0;
+  // Identifies the pad of a notification.
+  PadLookup padLookup;
+
+  // Tracks the pads of an AddPads() call that are still being plugged in.
+  std::mutex addMutex;
+  std::condition_variable addDone;
+  size_t pendingAdds = 0;
+  VIGEM_ERROR addError = VIGEM_ERROR_NONE;
+  // The pads of that call whose add succeeded.
+  std::vector<PVIGEM_TARGET> pluggedIn;
+};
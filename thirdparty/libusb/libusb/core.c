@@ -1451,7 +1451,7 @@ static void do_close(struct libusb_context *ctx,
 		 * we don't accidentally use the device handle in the future
 		 * (or that such accesses will be easily caught and identified as a crash)
 		 */
-		list_del(&itransfer->list);
+		usbi_remove_from_flying_list(ctx, itransfer);
 		transfer->dev_handle = NULL;
 
 		/* it is up to the user to free up the actual transfer struct.  this is
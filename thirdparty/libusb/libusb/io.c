@@ -36,6 +36,10 @@
 #include <unistd.h>
 #include <sys/timerfd.h>
 #endif
+#ifdef USBI_EPOLL_AVAILABLE
+#include <unistd.h>
+#include <sys/epoll.h>
+#endif
 
 #include "libusbi.h"
 #include "hotplug.h"
@@ -1135,6 +1139,20 @@ int usbi_io_init(struct libusb_context *ctx)
 	list_init(&ctx->removed_ipollfds);
 	list_init(&ctx->hotplug_msgs);
 	list_init(&ctx->completed_transfers);
+	list_init(&ctx->transfer_pool);
+
+#ifdef USBI_EPOLL_AVAILABLE
+	ctx->epoll_fd = -1;
+	if (usbi_backend.handle_ready_fds) {
+		ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+		if (ctx->epoll_fd >= 0) {
+			usbi_dbg("using epoll for event handling");
+		} else {
+			usbi_dbg("epoll not available (code %d error %d)", ctx->epoll_fd, errno);
+			ctx->epoll_fd = -1;
+		}
+	}
+#endif
 
 	/* FIXME should use an eventfd on kernels that support it */
 	r = usbi_pipe(ctx->event_pipe);
@@ -1172,6 +1190,10 @@ err_close_pipe:
 	usbi_close(ctx->event_pipe[0]);
 	usbi_close(ctx->event_pipe[1]);
 err:
+#ifdef USBI_EPOLL_AVAILABLE
+	if (usbi_using_epoll(ctx))
+		close(ctx->epoll_fd);
+#endif
 	usbi_mutex_destroy(&ctx->flying_transfers_lock);
 	usbi_mutex_destroy(&ctx->events_lock);
 	usbi_mutex_destroy(&ctx->event_waiters_lock);
@@ -1190,8 +1212,18 @@ static void cleanup_removed_pollfds(struct libusb_context *ctx)
 	}
 }
 
+static void free_itransfer(struct usbi_transfer *itransfer)
+{
+	if (usbi_backend.free_transfer_priv)
+		usbi_backend.free_transfer_priv(itransfer);
+	usbi_mutex_destroy(&itransfer->lock);
+	free(itransfer);
+}
+
 void usbi_io_exit(struct libusb_context *ctx)
 {
+	struct usbi_transfer *itransfer, *tmp;
+
 	usbi_remove_pollfd(ctx, ctx->event_pipe[0]);
 	usbi_close(ctx->event_pipe[0]);
 	usbi_close(ctx->event_pipe[1]);
@@ -1200,6 +1232,10 @@ void usbi_io_exit(struct libusb_context *ctx)
 		usbi_remove_pollfd(ctx, ctx->timerfd);
 		close(ctx->timerfd);
 	}
+#endif
+#ifdef USBI_EPOLL_AVAILABLE
+	if (usbi_using_epoll(ctx))
+		close(ctx->epoll_fd);
 #endif
 	usbi_mutex_destroy(&ctx->flying_transfers_lock);
 	usbi_mutex_destroy(&ctx->events_lock);
@@ -1208,7 +1244,12 @@ void usbi_io_exit(struct libusb_context *ctx)
 	usbi_mutex_destroy(&ctx->event_data_lock);
 	usbi_tls_key_delete(ctx->event_handling_key);
 	free(ctx->pollfds);
+	free(ctx->timeouts);
 	cleanup_removed_pollfds(ctx);
+	list_for_each_entry_safe(itransfer, tmp, &ctx->transfer_pool, list, struct usbi_transfer) {
+		list_del(&itransfer->list);
+		free_itransfer(itransfer);
+	}
 }
 
 static int calculate_timeout(struct usbi_transfer *transfer)
@@ -1320,8 +1361,161 @@ void API_EXPORTED libusb_free_transfer(struct libusb_transfer *transfer)
 		free(transfer->buffer);
 
 	itransfer = LIBUSB_TRANSFER_TO_USBI_TRANSFER(transfer);
+	free_itransfer(itransfer);
+}
+
+/* the synchronous API allocates a transfer for each request and frees it
+ * before returning, so it keeps the transfers it frees in a pool in the
+ * context for the next request, along with whatever the backend keeps in their
+ * private data. libusb_alloc_transfer() has no context to take a transfer
+ * from, so the transfers it hands out always come from the system allocator. */
+#define USBI_TRANSFER_POOL_MAX	8
+
+struct libusb_transfer *usbi_alloc_transfer(struct libusb_context *ctx)
+{
+	struct usbi_transfer *itransfer = NULL;
+	size_t alloc_size;
+
+	usbi_mutex_lock(&ctx->flying_transfers_lock);
+	if (!list_empty(&ctx->transfer_pool)) {
+		itransfer = list_first_entry(&ctx->transfer_pool, struct usbi_transfer, list);
+		list_del(&itransfer->list);
+		ctx->transfer_pool_cnt--;
+	}
+	usbi_mutex_unlock(&ctx->flying_transfers_lock);
+	if (!itransfer)
+		return libusb_alloc_transfer(0);
+
+	/* a backend that keeps memory between submissions sets up the rest of its
+	 * private data on each submission, as for a transfer that is reused */
+	alloc_size = sizeof(struct usbi_transfer) + sizeof(struct libusb_transfer);
+	if (!usbi_backend.free_transfer_priv)
+		alloc_size += usbi_backend.transfer_priv_size;
 	usbi_mutex_destroy(&itransfer->lock);
-	free(itransfer);
+	memset(itransfer, 0, alloc_size);
+	usbi_mutex_init(&itransfer->lock);
+	usbi_dbg("transfer %p", USBI_TRANSFER_TO_LIBUSB_TRANSFER(itransfer));
+	return USBI_TRANSFER_TO_LIBUSB_TRANSFER(itransfer);
+}
+
+void usbi_free_transfer(struct libusb_context *ctx,
+	struct libusb_transfer *transfer)
+{
+	struct usbi_transfer *itransfer = LIBUSB_TRANSFER_TO_USBI_TRANSFER(transfer);
+
+	usbi_dbg("transfer %p", transfer);
+	if (transfer->flags & LIBUSB_TRANSFER_FREE_BUFFER)
+		free(transfer->buffer);
+
+	usbi_mutex_lock(&ctx->flying_transfers_lock);
+	if (ctx->transfer_pool_cnt < USBI_TRANSFER_POOL_MAX) {
+		list_add(&itransfer->list, &ctx->transfer_pool);
+		ctx->transfer_pool_cnt++;
+		itransfer = NULL;
+	}
+	usbi_mutex_unlock(&ctx->flying_transfers_lock);
+	if (itransfer)
+		free_itransfer(itransfer);
+}
+
+/* the in-flight transfers with a timeout still to be handled are kept in
+ * ctx->timeouts, a binary min-heap ordered by timeout. it starts at index 1, so
+ * the parent of position i is i / 2, and each transfer records its position so
+ * that it can be taken out when it completes.
+ * these must be called with flying_list locked. */
+static int timeout_before(struct usbi_transfer *a, struct usbi_transfer *b)
+{
+	return timercmp(&a->timeout, &b->timeout, <);
+}
+
+static void timeouts_set(struct libusb_context *ctx, unsigned int pos,
+	struct usbi_transfer *transfer)
+{
+	ctx->timeouts[pos] = transfer;
+	transfer->timeout_pos = pos;
+}
+
+static void timeouts_sift_up(struct libusb_context *ctx, unsigned int pos)
+{
+	struct usbi_transfer *transfer = ctx->timeouts[pos];
+
+	while (pos > 1 && timeout_before(transfer, ctx->timeouts[pos / 2])) {
+		timeouts_set(ctx, pos, ctx->timeouts[pos / 2]);
+		pos /= 2;
+	}
+	timeouts_set(ctx, pos, transfer);
+}
+
+static void timeouts_sift_down(struct libusb_context *ctx, unsigned int pos)
+{
+	struct usbi_transfer *transfer = ctx->timeouts[pos];
+	unsigned int child;
+
+	while ((child = pos * 2) <= ctx->timeouts_cnt) {
+		if (child < ctx->timeouts_cnt &&
+				timeout_before(ctx->timeouts[child + 1], ctx->timeouts[child]))
+			child++;
+		if (!timeout_before(ctx->timeouts[child], transfer))
+			break;
+		timeouts_set(ctx, pos, ctx->timeouts[child]);
+		pos = child;
+	}
+	timeouts_set(ctx, pos, transfer);
+}
+
+static int timeouts_add(struct libusb_context *ctx,
+	struct usbi_transfer *transfer)
+{
+	if (ctx->timeouts_cnt + 1 >= ctx->timeouts_size) {
+		unsigned int size = ctx->timeouts_size ? ctx->timeouts_size * 2 : 64;
+		struct usbi_transfer **timeouts =
+			realloc(ctx->timeouts, size * sizeof(*timeouts));
+
+		if (!timeouts)
+			return LIBUSB_ERROR_NO_MEM;
+		ctx->timeouts = timeouts;
+		ctx->timeouts_size = size;
+	}
+
+	ctx->timeouts[++ctx->timeouts_cnt] = transfer;
+	timeouts_sift_up(ctx, ctx->timeouts_cnt);
+	return 0;
+}
+
+static void timeouts_remove(struct libusb_context *ctx,
+	struct usbi_transfer *transfer)
+{
+	unsigned int pos = transfer->timeout_pos;
+	struct usbi_transfer *last;
+
+	if (!pos)
+		return;
+
+	transfer->timeout_pos = 0;
+	last = ctx->timeouts[ctx->timeouts_cnt--];
+	if (last == transfer)
+		return;
+
+	/* move the last transfer into the hole and restore the heap order */
+	timeouts_set(ctx, pos, last);
+	if (pos > 1 && timeout_before(last, ctx->timeouts[pos / 2]))
+		timeouts_sift_up(ctx, pos);
+	else
+		timeouts_sift_down(ctx, pos);
+}
+
+/* returns the transfer with the next timeout to handle, or NULL if there is
+ * none. transfers whose timeout is handled by the OS are dropped on the way. */
+static struct usbi_transfer *timeouts_first(struct libusb_context *ctx)
+{
+	while (ctx->timeouts_cnt) {
+		struct usbi_transfer *transfer = ctx->timeouts[1];
+
+		if (!(transfer->timeout_flags & (USBI_TRANSFER_TIMEOUT_HANDLED | USBI_TRANSFER_OS_HANDLES_TIMEOUT)))
+			return transfer;
+		timeouts_remove(ctx, transfer);
+	}
+	return NULL;
 }
 
 #ifdef USBI_TIMERFD_AVAILABLE
@@ -1338,37 +1532,26 @@ static int disarm_timerfd(struct libusb_context *ctx)
 		return 0;
 }
 
-/* iterates through the flying transfers, and rearms the timerfd based on the
- * next upcoming timeout.
+/* rearms the timerfd based on the next upcoming timeout.
  * must be called with flying_list locked.
  * returns 0 on success or a LIBUSB_ERROR code on failure.
  */
 static int arm_timerfd_for_next_timeout(struct libusb_context *ctx)
 {
-	struct usbi_transfer *transfer;
+	struct usbi_transfer *transfer = timeouts_first(ctx);
 
-	list_for_each_entry(transfer, &ctx->flying_transfers, list, struct usbi_transfer) {
+	if (transfer) {
 		struct timeval *cur_tv = &transfer->timeout;
-
-		/* if we've reached transfers of infinite timeout, then we have no
-		 * arming to do */
-		if (!timerisset(cur_tv))
-			goto disarm;
-
-		/* act on first transfer that has not already been handled */
-		if (!(transfer->timeout_flags & (USBI_TRANSFER_TIMEOUT_HANDLED | USBI_TRANSFER_OS_HANDLES_TIMEOUT))) {
-			int r;
-			const struct itimerspec it = { {0, 0},
-				{ cur_tv->tv_sec, cur_tv->tv_usec * 1000 } };
-			usbi_dbg("next timeout originally %dms", USBI_TRANSFER_TO_LIBUSB_TRANSFER(transfer)->timeout);
-			r = timerfd_settime(ctx->timerfd, TFD_TIMER_ABSTIME, &it, NULL);
-			if (r < 0)
-				return LIBUSB_ERROR_OTHER;
-			return 0;
-		}
+		int r;
+		const struct itimerspec it = { {0, 0},
+			{ cur_tv->tv_sec, cur_tv->tv_usec * 1000 } };
+		usbi_dbg("next timeout originally %dms", USBI_TRANSFER_TO_LIBUSB_TRANSFER(transfer)->timeout);
+		r = timerfd_settime(ctx->timerfd, TFD_TIMER_ABSTIME, &it, NULL);
+		if (r < 0)
+			return LIBUSB_ERROR_OTHER;
+		return 0;
 	}
 
-disarm:
 	return disarm_timerfd(ctx);
 }
 #else
@@ -1379,54 +1562,28 @@ static int arm_timerfd_for_next_timeout(struct libusb_context *ctx)
 }
 #endif
 
-/* add a transfer to the (timeout-sorted) active transfers list.
- * This function will return non 0 if fails to update the timer,
+/* add a transfer to the active transfers list, and to the timeouts if it has
+ * one. This function will return non 0 if fails to update the timer,
  * in which case the transfer is *not* on the flying_transfers list. */
 static int add_to_flying_list(struct usbi_transfer *transfer)
 {
-	struct usbi_transfer *cur;
 	struct timeval *timeout = &transfer->timeout;
 	struct libusb_context *ctx = ITRANSFER_CTX(transfer);
 	int r;
-	int first = 1;
 
 	r = calculate_timeout(transfer);
 	if (r)
 		return r;
 
-	/* if we have no other flying transfers, start the list with this one */
-	if (list_empty(&ctx->flying_transfers)) {
-		list_add(&transfer->list, &ctx->flying_transfers);
-		goto out;
-	}
-
-	/* if we have infinite timeout, append to end of list */
-	if (!timerisset(timeout)) {
-		list_add_tail(&transfer->list, &ctx->flying_transfers);
-		/* first is irrelevant in this case */
-		goto out;
-	}
-
-	/* otherwise, find appropriate place in list */
-	list_for_each_entry(cur, &ctx->flying_transfers, list, struct usbi_transfer) {
-		/* find first timeout that occurs after the transfer in question */
-		struct timeval *cur_tv = &cur->timeout;
+	list_add_tail(&transfer->list, &ctx->flying_transfers);
 
-		if (!timerisset(cur_tv) || (cur_tv->tv_sec > timeout->tv_sec) ||
-				(cur_tv->tv_sec == timeout->tv_sec &&
-					cur_tv->tv_usec > timeout->tv_usec)) {
-			list_add_tail(&transfer->list, &cur->list);
-			goto out;
-		}
-		first = 0;
-	}
-	/* first is 0 at this stage (list not empty) */
+	/* transfers with infinite timeout never need timing out */
+	if (!timerisset(timeout))
+		return 0;
 
-	/* otherwise we need to be inserted at the end */
-	list_add_tail(&transfer->list, &ctx->flying_transfers);
-out:
+	r = timeouts_add(ctx, transfer);
 #ifdef USBI_TIMERFD_AVAILABLE
-	if (first && usbi_using_timerfd(ctx) && timerisset(timeout)) {
+	if (!r && transfer->timeout_pos == 1 && usbi_using_timerfd(ctx)) {
 		/* if this transfer has the lowest timeout of all active transfers,
 		 * rearm the timerfd with this transfer's timeout */
 		const struct itimerspec it = { {0, 0},
@@ -1439,16 +1596,23 @@ out:
 			r = LIBUSB_ERROR_OTHER;
 		}
 	}
-#else
-	UNUSED(first);
 #endif
 
 	if (r)
-		list_del(&transfer->list);
+		usbi_remove_from_flying_list(ctx, transfer);
 
 	return r;
 }
 
+/* remove a transfer from the active transfers list and the timeouts, without
+ * rearming the timer. must be called with flying_list locked. */
+void usbi_remove_from_flying_list(struct libusb_context *ctx,
+	struct usbi_transfer *transfer)
+{
+	list_del(&transfer->list);
+	timeouts_remove(ctx, transfer);
+}
+
 /* remove a transfer from the active transfers list.
  * This function will *always* remove the transfer from the
  * flying_transfers list. It will return a LIBUSB_ERROR code
@@ -1460,9 +1624,9 @@ static int remove_from_flying_list(struct usbi_transfer *transfer)
 	int r = 0;
 
 	usbi_mutex_lock(&ctx->flying_transfers_lock);
-	rearm_timerfd = (timerisset(&transfer->timeout) &&
-		list_first_entry(&ctx->flying_transfers, struct usbi_transfer, list) == transfer);
-	list_del(&transfer->list);
+	/* the timerfd is armed for the transfer at the top of the timeouts */
+	rearm_timerfd = (transfer->timeout_pos == 1);
+	usbi_remove_from_flying_list(ctx, transfer);
 	if (usbi_using_timerfd(ctx) && rearm_timerfd)
 		r = arm_timerfd_for_next_timeout(ctx);
 	usbi_mutex_unlock(&ctx->flying_transfers_lock);
@@ -2025,7 +2189,7 @@ static int handle_timeouts_locked(struct libusb_context *ctx)
 	struct timeval systime;
 	struct usbi_transfer *transfer;
 
-	if (list_empty(&ctx->flying_transfers))
+	if (!ctx->timeouts_cnt)
 		return 0;
 
 	/* get current time */
@@ -2035,26 +2199,20 @@ static int handle_timeouts_locked(struct libusb_context *ctx)
 
 	TIMESPEC_TO_TIMEVAL(&systime, &systime_ts);
 
-	/* iterate through flying transfers list, finding all transfers that
-	 * have expired timeouts */
-	list_for_each_entry(transfer, &ctx->flying_transfers, list, struct usbi_transfer) {
+	/* take transfers off the timeouts in order of expiry, until reaching one
+	 * that has not expired yet */
+	while ((transfer = timeouts_first(ctx)) != NULL) {
 		struct timeval *cur_tv = &transfer->timeout;
 
-		/* if we've reached transfers of infinite timeout, we're all done */
-		if (!timerisset(cur_tv))
-			return 0;
-
-		/* ignore timeouts we've already handled */
-		if (transfer->timeout_flags & (USBI_TRANSFER_TIMEOUT_HANDLED | USBI_TRANSFER_OS_HANDLES_TIMEOUT))
-			continue;
-
 		/* if transfer has non-expired timeout, nothing more to do */
 		if ((cur_tv->tv_sec > systime.tv_sec) ||
 				(cur_tv->tv_sec == systime.tv_sec &&
 					cur_tv->tv_usec > systime.tv_usec))
 			return 0;
 
-		/* otherwise, we've got an expired timeout to handle */
+		/* otherwise, we've got an expired timeout to handle. the transfer
+		 * stays in flight until its cancellation completes */
+		timeouts_remove(ctx, transfer);
 		handle_timeout(transfer);
 	}
 	return 0;
@@ -2091,6 +2249,194 @@ out:
 }
 #endif
 
+/* process the internal events that were signalled through the event pipe */
+static int handle_event_pipe(struct libusb_context *ctx)
+{
+	struct list_head hotplug_msgs;
+	struct usbi_transfer *itransfer;
+	int hotplug_cb_deregistered = 0;
+	int ret = 0;
+
+	list_init(&hotplug_msgs);
+
+	usbi_dbg("caught a fish on the event pipe");
+
+	/* take the the event data lock while processing events */
+	usbi_mutex_lock(&ctx->event_data_lock);
+
+	/* check if someone added a new poll fd */
+	if (ctx->event_flags & USBI_EVENT_POLLFDS_MODIFIED)
+		usbi_dbg("someone updated the poll fds");
+
+	if (ctx->event_flags & USBI_EVENT_USER_INTERRUPT) {
+		usbi_dbg("someone purposely interrupted");
+		ctx->event_flags &= ~USBI_EVENT_USER_INTERRUPT;
+	}
+
+	if (ctx->event_flags & USBI_EVENT_HOTPLUG_CB_DEREGISTERED) {
+		usbi_dbg("someone unregistered a hotplug cb");
+		ctx->event_flags &= ~USBI_EVENT_HOTPLUG_CB_DEREGISTERED;
+		hotplug_cb_deregistered = 1;
+	}
+
+	/* check if someone is closing a device */
+	if (ctx->device_close)
+		usbi_dbg("someone is closing a device");
+
+	/* check for any pending hotplug messages */
+	if (!list_empty(&ctx->hotplug_msgs)) {
+		usbi_dbg("hotplug message received");
+		list_cut(&hotplug_msgs, &ctx->hotplug_msgs);
+	}
+
+	/* complete any pending transfers */
+	while (ret == 0 && !list_empty(&ctx->completed_transfers)) {
+		itransfer = list_first_entry(&ctx->completed_transfers, struct usbi_transfer, completed_list);
+		list_del(&itransfer->completed_list);
+		usbi_mutex_unlock(&ctx->event_data_lock);
+		ret = usbi_backend.handle_transfer_completion(itransfer);
+		if (ret)
+			usbi_err(ctx, "backend handle_transfer_completion failed with error %d", ret);
+		usbi_mutex_lock(&ctx->event_data_lock);
+	}
+
+	/* if no further pending events, clear the event pipe */
+	if (!usbi_pending_events(ctx))
+		usbi_clear_event(ctx);
+
+	usbi_mutex_unlock(&ctx->event_data_lock);
+
+	if (hotplug_cb_deregistered)
+		usbi_hotplug_deregister(ctx, 0);
+
+	/* process the hotplug messages, if any */
+	while (!list_empty(&hotplug_msgs)) {
+		struct libusb_hotplug_message *message =
+			list_first_entry(&hotplug_msgs, struct libusb_hotplug_message, list);
+
+		usbi_hotplug_match(ctx, message->device, message->event);
+
+		/* the device left, dereference the device */
+		if (LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT == message->event)
+			libusb_unref_device(message->device);
+
+		list_del(&message->list);
+		free(message);
+	}
+
+	return ret;
+}
+
+#ifdef USBI_EPOLL_AVAILABLE
+/* the most fds handled per wakeup. any others stay ready for the next one */
+#define USBI_EPOLL_MAX_EVENTS	64
+
+static uint32_t poll_to_epoll_events(short events)
+{
+	uint32_t r = 0;
+
+	if (events & POLLIN)
+		r |= EPOLLIN;
+	if (events & POLLOUT)
+		r |= EPOLLOUT;
+	return r;
+}
+
+static short epoll_to_poll_events(uint32_t events)
+{
+	short r = 0;
+
+	if (events & EPOLLIN)
+		r |= POLLIN;
+	if (events & EPOLLOUT)
+		r |= POLLOUT;
+	if (events & EPOLLERR)
+		r |= POLLERR;
+	if (events & EPOLLHUP)
+		r |= POLLHUP;
+	return r;
+}
+
+/* the epoll equivalent of the poll() path in handle_events(). fds are
+ * registered with the epoll instance as they are added, so there is no fd
+ * array to rebuild and only the fds that are ready are looked at. */
+static int handle_events_epoll(struct libusb_context *ctx, int timeout_ms)
+{
+	struct epoll_event events[USBI_EPOLL_MAX_EVENTS];
+	struct usbi_ready_fd ready[USBI_EPOLL_MAX_EVENTS];
+	int event_pipe_ready = 0;
+	int timerfd_ready = 0;
+	int nready = 0;
+	int r, i;
+
+	/* removed fds are no longer registered, so no wait from here on can
+	 * report them */
+	usbi_mutex_lock(&ctx->event_data_lock);
+	cleanup_removed_pollfds(ctx);
+	usbi_mutex_unlock(&ctx->event_data_lock);
+
+	usbi_dbg("epoll_wait() with timeout in %dms", timeout_ms);
+	r = epoll_wait(ctx->epoll_fd, events, USBI_EPOLL_MAX_EVENTS, timeout_ms);
+	usbi_dbg("epoll_wait() returned %d", r);
+	if (r == 0) {
+		return handle_timeouts(ctx);
+	} else if (r == -1 && errno == EINTR) {
+		return LIBUSB_ERROR_INTERRUPTED;
+	} else if (r < 0) {
+		usbi_err(ctx, "epoll_wait failed %d err=%d", r, errno);
+		return LIBUSB_ERROR_IO;
+	}
+
+	usbi_mutex_lock(&ctx->event_data_lock);
+	for (i = 0; i < r; i++) {
+		struct usbi_pollfd *ipollfd = events[i].data.ptr;
+		int fd = ipollfd->pollfd.fd;
+
+		if (ipollfd->removed) {
+			/* pollfd was removed after epoll_wait() returned. remove
+			 * any triggered revent as it is no longer relevant */
+			usbi_dbg("pollfd %d was removed. ignoring raised events", fd);
+			continue;
+		}
+
+		if (fd == ctx->event_pipe[0]) {
+			event_pipe_ready = 1;
+		} else if (usbi_using_timerfd(ctx) && fd == ctx->timerfd) {
+			timerfd_ready = 1;
+		} else {
+			ready[nready].fd = fd;
+			ready[nready].revents = epoll_to_poll_events(events[i].events);
+			ready[nready].user_data = ipollfd->user_data;
+			nready++;
+		}
+	}
+	usbi_mutex_unlock(&ctx->event_data_lock);
+
+	if (event_pipe_ready) {
+		r = handle_event_pipe(ctx);
+		if (r)
+			return r;
+	}
+
+#ifdef USBI_TIMERFD_AVAILABLE
+	if (timerfd_ready) {
+		usbi_dbg("timerfd triggered");
+		r = handle_timerfd_trigger(ctx);
+		if (r < 0)
+			return r;
+	}
+#endif
+
+	if (!nready)
+		return 0;
+
+	r = usbi_backend.handle_ready_fds(ctx, ready, nready);
+	if (r)
+		usbi_err(ctx, "backend handle_ready_fds failed with error %d", r);
+	return r;
+}
+#endif
+
 /* do the actual event handling. assumes that no other thread is concurrently
  * doing the same thing. */
 static int handle_events(struct libusb_context *ctx, struct timeval *tv)
@@ -2116,6 +2462,19 @@ static int handle_events(struct libusb_context *ctx, struct timeval *tv)
 	if (r)
 		return r;
 
+	timeout_ms = (int)(tv->tv_sec * 1000) + (tv->tv_usec / 1000);
+
+	/* round up to next millisecond */
+	if (tv->tv_usec % 1000)
+		timeout_ms++;
+
+#ifdef USBI_EPOLL_AVAILABLE
+	if (usbi_using_epoll(ctx)) {
+		r = handle_events_epoll(ctx, timeout_ms);
+		goto done;
+	}
+#endif
+
 	/* there are certain fds that libusb uses internally, currently:
 	 *
 	 *   1) event pipe
@@ -2172,12 +2531,6 @@ static int handle_events(struct libusb_context *ctx, struct timeval *tv)
 	usbi_inc_fds_ref(fds, nfds);
 	usbi_mutex_unlock(&ctx->event_data_lock);
 
-	timeout_ms = (int)(tv->tv_sec * 1000) + (tv->tv_usec / 1000);
-
-	/* round up to next millisecond */
-	if (tv->tv_usec % 1000)
-		timeout_ms++;
-
 	usbi_dbg("poll() %d fds with timeout in %dms", (int)nfds, timeout_ms);
 	r = usbi_poll(fds, nfds, timeout_ms);
 	usbi_dbg("poll() returned %d", r);
@@ -2195,78 +2548,7 @@ static int handle_events(struct libusb_context *ctx, struct timeval *tv)
 
 	/* fds[0] is always the event pipe */
 	if (fds[0].revents) {
-		struct list_head hotplug_msgs;
-		struct usbi_transfer *itransfer;
-		int hotplug_cb_deregistered = 0;
-		int ret = 0;
-
-		list_init(&hotplug_msgs);
-
-		usbi_dbg("caught a fish on the event pipe");
-
-		/* take the the event data lock while processing events */
-		usbi_mutex_lock(&ctx->event_data_lock);
-
-		/* check if someone added a new poll fd */
-		if (ctx->event_flags & USBI_EVENT_POLLFDS_MODIFIED)
-			usbi_dbg("someone updated the poll fds");
-
-		if (ctx->event_flags & USBI_EVENT_USER_INTERRUPT) {
-			usbi_dbg("someone purposely interrupted");
-			ctx->event_flags &= ~USBI_EVENT_USER_INTERRUPT;
-		}
-
-		if (ctx->event_flags & USBI_EVENT_HOTPLUG_CB_DEREGISTERED) {
-			usbi_dbg("someone unregistered a hotplug cb");
-			ctx->event_flags &= ~USBI_EVENT_HOTPLUG_CB_DEREGISTERED;
-			hotplug_cb_deregistered = 1;
-		}
-
-		/* check if someone is closing a device */
-		if (ctx->device_close)
-			usbi_dbg("someone is closing a device");
-
-		/* check for any pending hotplug messages */
-		if (!list_empty(&ctx->hotplug_msgs)) {
-			usbi_dbg("hotplug message received");
-			list_cut(&hotplug_msgs, &ctx->hotplug_msgs);
-		}
-
-		/* complete any pending transfers */
-		while (ret == 0 && !list_empty(&ctx->completed_transfers)) {
-			itransfer = list_first_entry(&ctx->completed_transfers, struct usbi_transfer, completed_list);
-			list_del(&itransfer->completed_list);
-			usbi_mutex_unlock(&ctx->event_data_lock);
-			ret = usbi_backend.handle_transfer_completion(itransfer);
-			if (ret)
-				usbi_err(ctx, "backend handle_transfer_completion failed with error %d", ret);
-			usbi_mutex_lock(&ctx->event_data_lock);
-		}
-
-		/* if no further pending events, clear the event pipe */
-		if (!usbi_pending_events(ctx))
-			usbi_clear_event(ctx);
-
-		usbi_mutex_unlock(&ctx->event_data_lock);
-
-		if (hotplug_cb_deregistered)
-			usbi_hotplug_deregister(ctx, 0);
-
-		/* process the hotplug messages, if any */
-		while (!list_empty(&hotplug_msgs)) {
-			struct libusb_hotplug_message *message =
-				list_first_entry(&hotplug_msgs, struct libusb_hotplug_message, list);
-
-			usbi_hotplug_match(ctx, message->device, message->event);
-
-			/* the device left, dereference the device */
-			if (LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT == message->event)
-				libusb_unref_device(message->device);
-
-			list_del(&message->list);
-			free(message);
-		}
-
+		int ret = handle_event_pipe(ctx);
 		if (ret) {
 			/* return error code */
 			r = ret;
@@ -2607,24 +2889,10 @@ int API_EXPORTED libusb_get_next_timeout(libusb_context *ctx,
 		return 0;
 
 	usbi_mutex_lock(&ctx->flying_transfers_lock);
-	if (list_empty(&ctx->flying_transfers)) {
-		usbi_mutex_unlock(&ctx->flying_transfers_lock);
-		usbi_dbg("no URBs, no timeout!");
-		return 0;
-	}
-
 	/* find next transfer which hasn't already been processed as timed out */
-	list_for_each_entry(transfer, &ctx->flying_transfers, list, struct usbi_transfer) {
-		if (transfer->timeout_flags & (USBI_TRANSFER_TIMEOUT_HANDLED | USBI_TRANSFER_OS_HANDLES_TIMEOUT))
-			continue;
-
-		/* if we've reached transfers of infinte timeout, we're done looking */
-		if (!timerisset(&transfer->timeout))
-			break;
-
+	transfer = timeouts_first(ctx);
+	if (transfer)
 		next_timeout = transfer->timeout;
-		break;
-	}
 	usbi_mutex_unlock(&ctx->flying_transfers_lock);
 
 	if (!timerisset(&next_timeout)) {
@@ -2701,6 +2969,14 @@ static void usbi_fd_notification(struct libusb_context *ctx)
  * events should be specified as a bitmask of events passed to poll(), e.g.
  * POLLIN and/or POLLOUT. */
 int usbi_add_pollfd(struct libusb_context *ctx, int fd, short events)
+{
+	return usbi_add_pollfd_data(ctx, fd, events, NULL);
+}
+
+/* Like usbi_add_pollfd(), and user_data is passed back to the backend's
+ * handle_ready_fds function along with the fd when it is ready. */
+int usbi_add_pollfd_data(struct libusb_context *ctx, int fd, short events,
+	void *user_data)
 {
 	struct usbi_pollfd *ipollfd = malloc(sizeof(*ipollfd));
 	if (!ipollfd)
@@ -2709,10 +2985,28 @@ int usbi_add_pollfd(struct libusb_context *ctx, int fd, short events)
 	usbi_dbg("add fd %d events %d", fd, events);
 	ipollfd->pollfd.fd = fd;
 	ipollfd->pollfd.events = events;
+	ipollfd->user_data = user_data;
+	ipollfd->removed = 0;
+#ifdef USBI_EPOLL_AVAILABLE
+	if (usbi_using_epoll(ctx)) {
+		struct epoll_event event;
+
+		memset(&event, 0, sizeof(event));
+		event.events = poll_to_epoll_events(events);
+		event.data.ptr = ipollfd;
+		if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+			usbi_err(ctx, "failed to add fd %d to epoll, errno=%d", fd, errno);
+			free(ipollfd);
+			return LIBUSB_ERROR_OTHER;
+		}
+	}
+#endif
 	usbi_mutex_lock(&ctx->event_data_lock);
 	list_add_tail(&ipollfd->list, &ctx->ipollfds);
 	ctx->pollfds_cnt++;
-	usbi_fd_notification(ctx);
+	/* a thread waiting in epoll_wait() sees the new fd without being woken */
+	if (!usbi_using_epoll(ctx))
+		usbi_fd_notification(ctx);
 	usbi_mutex_unlock(&ctx->event_data_lock);
 
 	if (ctx->fd_added_cb)
@@ -2742,7 +3036,14 @@ void usbi_remove_pollfd(struct libusb_context *ctx, int fd)
 
 	list_del(&ipollfd->list);
 	list_add_tail(&ipollfd->list, &ctx->removed_ipollfds);
+	ipollfd->removed = 1;
 	ctx->pollfds_cnt--;
+#ifdef USBI_EPOLL_AVAILABLE
+	if (usbi_using_epoll(ctx)) {
+		if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, fd, NULL) < 0)
+			usbi_dbg("failed to remove fd %d from epoll, errno=%d", fd, errno);
+	} else
+#endif
 	usbi_fd_notification(ctx);
 	usbi_mutex_unlock(&ctx->event_data_lock);
 
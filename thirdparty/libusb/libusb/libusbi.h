@@ -324,15 +324,24 @@ struct libusb_context {
 	libusb_hotplug_callback_handle next_hotplug_cb_handle;
 	usbi_mutex_t hotplug_cbs_lock;
 
-	/* this is a list of in-flight transfer handles, sorted by timeout
-	 * expiration. URBs to timeout the soonest are placed at the beginning of
-	 * the list, URBs that will time out later are placed after, and urbs with
-	 * infinite timeout are always placed at the very end. */
+	/* this is a list of in-flight transfer handles, in submission order. */
 	struct list_head flying_transfers;
+	/* the in-flight transfers whose timeout is still to be handled, as a
+	 * binary min-heap ordered by timeout expiration, so that adding or
+	 * removing a transfer costs O(log n) rather than a walk of the list.
+	 * the heap starts at timeouts[1]. Protected by flying_transfers_lock. */
+	struct usbi_transfer **timeouts;
+	unsigned int timeouts_cnt;
+	unsigned int timeouts_size;
 	/* Note paths taking both this and usbi_transfer->lock must always
 	 * take this lock first */
 	usbi_mutex_t flying_transfers_lock;
 
+	/* transfers kept for reuse by the synchronous API. Protected by
+	 * flying_transfers_lock. */
+	struct list_head transfer_pool;
+	unsigned int transfer_pool_cnt;
+
 	/* user callbacks for pollfd changes */
 	libusb_pollfd_added_cb fd_added_cb;
 	libusb_pollfd_removed_cb fd_removed_cb;
@@ -385,6 +394,13 @@ struct libusb_context {
 	int timerfd;
 #endif
 
+#ifdef USBI_EPOLL_AVAILABLE
+	/* if supported by OS, the poll fds are registered with this epoll
+	 * instance as they are added, so waiting never rebuilds an fd array and
+	 * returns only the fds that are ready */
+	int epoll_fd;
+#endif
+
 	struct list_head list;
 
 	PTR_ALIGNED unsigned char os_priv[ZERO_SIZED_ARRAY];
@@ -422,6 +438,12 @@ enum usbi_event_flags {
 #define usbi_using_timerfd(ctx) (0)
 #endif
 
+#ifdef USBI_EPOLL_AVAILABLE
+#define usbi_using_epoll(ctx) ((ctx)->epoll_fd >= 0)
+#else
+#define usbi_using_epoll(ctx) (0)
+#endif
+
 struct libusb_device {
 	/* lock protects refcnt, everything else is finalized at initialization
 	 * time */
@@ -485,6 +507,9 @@ struct usbi_transfer {
 	uint32_t stream_id;
 	uint8_t state_flags;   /* Protected by usbi_transfer->lock */
 	uint8_t timeout_flags; /* Protected by the flying_stransfers_lock */
+	/* position in ctx->timeouts, or 0 if not there.
+	 * Protected by the flying_transfers_lock */
+	unsigned int timeout_pos;
 
 	/* this lock is held during libusb_submit_transfer() and
 	 * libusb_cancel_transfer() (allowing the OS backend to prevent duplicate
@@ -559,6 +584,11 @@ void usbi_handle_disconnect(struct libusb_device_handle *dev_handle);
 int usbi_handle_transfer_completion(struct usbi_transfer *itransfer,
 	enum libusb_transfer_status status);
 int usbi_handle_transfer_cancellation(struct usbi_transfer *transfer);
+struct libusb_transfer *usbi_alloc_transfer(struct libusb_context *ctx);
+void usbi_free_transfer(struct libusb_context *ctx,
+	struct libusb_transfer *transfer);
+void usbi_remove_from_flying_list(struct libusb_context *ctx,
+	struct usbi_transfer *transfer);
 void usbi_signal_transfer_completion(struct usbi_transfer *transfer);
 
 int usbi_parse_descriptor(const unsigned char *source, const char *descriptor,
@@ -586,10 +616,27 @@ struct usbi_pollfd {
 	/* must come first */
 	struct libusb_pollfd pollfd;
 
+	/* backend data passed to usbi_add_pollfd_data(), handed back with the fd
+	 * when it is reported ready */
+	void *user_data;
+
+	/* set once the fd has been removed, so that events already collected for
+	 * it are ignored. Protected by event_data_lock. */
+	int removed;
+
 	struct list_head list;
 };
 
+/* An fd reported ready by epoll, with the data it was added with */
+struct usbi_ready_fd {
+	int fd;
+	short revents;
+	void *user_data;
+};
+
 int usbi_add_pollfd(struct libusb_context *ctx, int fd, short events);
+int usbi_add_pollfd_data(struct libusb_context *ctx, int fd, short events,
+	void *user_data);
 void usbi_remove_pollfd(struct libusb_context *ctx, int fd);
 
 /* device discovery */
@@ -1176,6 +1223,22 @@ struct usbi_os_backend {
 	clockid_t (*get_timerfd_clockid)(void);
 #endif
 
+#ifdef USBI_EPOLL_AVAILABLE
+	/* Handle events on the file descriptors that epoll reported ready.
+	 * Optional; the library only uses epoll for backends that provide it.
+	 *
+	 * Like handle_events, but only the fds with events are passed, each with
+	 * the user_data given to usbi_add_pollfd_data() when it was added. The
+	 * internal fds are never passed. This lets the backend find the device
+	 * that owns an fd without searching, so the cost of a wakeup depends on
+	 * the number of ready devices rather than the number of open ones.
+	 *
+	 * Return 0 on success, or a LIBUSB_ERROR code on failure.
+	 */
+	int (*handle_ready_fds)(struct libusb_context *ctx,
+		struct usbi_ready_fd *fds, int nfds);
+#endif
+
 	/* Number of bytes to reserve for per-context private backend data.
 	 * This private data area is accessible through the "os_priv" field of
 	 * struct libusb_context. */
@@ -1196,6 +1259,19 @@ struct usbi_os_backend {
 	 * usbi_transfer_get_os_priv() on the appropriate usbi_transfer instance.
 	 */
 	size_t transfer_priv_size;
+
+	/* Free memory that the backend keeps in a transfer's private data from
+	 * one submission to the next. Optional. This is called just before the
+	 * transfer itself is freed.
+	 *
+	 * A backend that provides this must set up its private data on every
+	 * submission, as a transfer taken from the synchronous API's pool has
+	 * it left as it was at the end of its last use.
+	 *
+	 * This comes after the sizes above so that backends which list the
+	 * members of this structure in order need not mention it.
+	 */
+	void (*free_transfer_priv)(struct usbi_transfer *itransfer);
 };
 
 extern const struct usbi_os_backend usbi_backend;
@@ -162,6 +162,14 @@ struct linux_device_priv {
 	int active_config; /* cache val for !sysfs_can_relate_devices  */
 };
 
+struct linux_context_priv {
+	/* the open handles indexed by their fd, so that op_handle_events() can
+	 * find the handle for a ready fd without searching. fds are small, so the
+	 * table stays small. protected by the context's open_devs_lock. */
+	struct libusb_device_handle **fd_handles;
+	int fd_handles_size;
+};
+
 struct linux_device_handle_priv {
 	int fd;
 	int fd_removed;
@@ -198,6 +206,13 @@ struct linux_transfer_priv {
 
 	/* next iso packet in user-supplied transfer to be populated */
 	int iso_packet_offset;
+
+	/* the URB of a transfer that needs only one, and the URBs of the last
+	 * transfer that needed more. they are kept from one submission to the
+	 * next, so that resubmitting a transfer allocates nothing. */
+	struct usbfs_urb urb;
+	struct usbfs_urb *spare_urbs;
+	int num_spare_urbs;
 };
 
 static int _open(const char *path, int flags)
@@ -255,6 +270,11 @@ static int _get_usbfs_fd(struct libusb_device *dev, mode_t mode, int silent)
 	return LIBUSB_ERROR_IO;
 }
 
+static struct linux_context_priv *_context_priv(struct libusb_context *ctx)
+{
+	return (struct linux_context_priv *) ctx->os_priv;
+}
+
 static struct linux_device_priv *_device_priv(struct libusb_device *dev)
 {
 	return (struct linux_device_priv *) dev->os_priv;
@@ -520,7 +540,7 @@ static int op_init(struct libusb_context *ctx)
 
 static void op_exit(struct libusb_context *ctx)
 {
-	UNUSED(ctx);
+	free(_context_priv(ctx)->fd_handles);
 	usbi_mutex_static_lock(&linux_hotplug_startstop_lock);
 	assert(init_count != 0);
 	if (!--init_count) {
@@ -1385,6 +1405,36 @@ static int linux_default_scan_devices (struct libusb_context *ctx)
 }
 #endif
 
+static int set_fd_handle(struct libusb_context *ctx, int fd,
+	struct libusb_device_handle *handle)
+{
+	struct linux_context_priv *cpriv = _context_priv(ctx);
+	int r = LIBUSB_SUCCESS;
+
+	usbi_mutex_lock(&ctx->open_devs_lock);
+	if (fd >= cpriv->fd_handles_size && handle) {
+		struct libusb_device_handle **fd_handles;
+		int size = cpriv->fd_handles_size ? cpriv->fd_handles_size : 64;
+
+		while (size <= fd)
+			size *= 2;
+		fd_handles = realloc(cpriv->fd_handles, size * sizeof(*fd_handles));
+		if (!fd_handles) {
+			r = LIBUSB_ERROR_NO_MEM;
+			goto out;
+		}
+		memset(fd_handles + cpriv->fd_handles_size, 0,
+			(size - cpriv->fd_handles_size) * sizeof(*fd_handles));
+		cpriv->fd_handles = fd_handles;
+		cpriv->fd_handles_size = size;
+	}
+	if (fd < cpriv->fd_handles_size)
+		cpriv->fd_handles[fd] = handle;
+out:
+	usbi_mutex_unlock(&ctx->open_devs_lock);
+	return r;
+}
+
 static int initialize_handle(struct libusb_device_handle *handle, int fd)
 {
 	struct linux_device_handle_priv *hpriv = _device_handle_priv(handle);
@@ -1405,7 +1455,15 @@ static int initialize_handle(struct libusb_device_handle *handle, int fd)
 			hpriv->caps |= USBFS_CAP_BULK_CONTINUATION;
 	}
 
-	return usbi_add_pollfd(HANDLE_CTX(handle), hpriv->fd, POLLOUT);
+	r = set_fd_handle(HANDLE_CTX(handle), fd, handle);
+	if (r < 0)
+		return r;
+
+	/* the handle comes back with the fd when epoll reports it ready */
+	r = usbi_add_pollfd_data(HANDLE_CTX(handle), hpriv->fd, POLLOUT, handle);
+	if (r < 0)
+		set_fd_handle(HANDLE_CTX(handle), fd, NULL);
+	return r;
 }
 
 static int op_wrap_sys_device(struct libusb_context *ctx,
@@ -1491,6 +1549,7 @@ static void op_close(struct libusb_device_handle *dev_handle)
 	/* fd may have already been removed by POLLERR condition in op_handle_events() */
 	if (!hpriv->fd_removed)
 		usbi_remove_pollfd(HANDLE_CTX(dev_handle), hpriv->fd);
+	set_fd_handle(HANDLE_CTX(dev_handle), hpriv->fd, NULL);
 	if (!hpriv->fd_keep)
 		close(hpriv->fd);
 }
@@ -1941,6 +2000,33 @@ static int discard_urbs(struct usbi_transfer *itransfer, int first, int last_plu
 	return ret;
 }
 
+static struct usbfs_urb *alloc_urbs(struct linux_transfer_priv *tpriv,
+	int num_urbs)
+{
+	struct usbfs_urb *urbs;
+
+	if (num_urbs == 1) {
+		memset(&tpriv->urb, 0, sizeof(tpriv->urb));
+		return &tpriv->urb;
+	}
+
+	if (num_urbs > tpriv->num_spare_urbs) {
+		urbs = realloc(tpriv->spare_urbs, num_urbs * sizeof(*urbs));
+		if (!urbs)
+			return NULL;
+		tpriv->spare_urbs = urbs;
+		tpriv->num_spare_urbs = num_urbs;
+	}
+	memset(tpriv->spare_urbs, 0, num_urbs * sizeof(*tpriv->spare_urbs));
+	return tpriv->spare_urbs;
+}
+
+/* the memory stays with the transfer until op_free_transfer_priv() */
+static void release_urbs(struct linux_transfer_priv *tpriv)
+{
+	tpriv->urbs = NULL;
+}
+
 static void free_iso_urbs(struct linux_transfer_priv *tpriv)
 {
 	int i;
@@ -2026,7 +2112,7 @@ static int submit_bulk_transfer(struct usbi_transfer *itransfer)
 	}
 	usbi_dbg("need %d urbs for new transfer with length %d", num_urbs,
 		transfer->length);
-	urbs = calloc(num_urbs, sizeof(struct usbfs_urb));
+	urbs = alloc_urbs(tpriv, num_urbs);
 	if (!urbs)
 		return LIBUSB_ERROR_NO_MEM;
 	tpriv->urbs = urbs;
@@ -2085,8 +2171,7 @@ static int submit_bulk_transfer(struct usbi_transfer *itransfer)
 			 * return failure immediately. */
 			if (i == 0) {
 				usbi_dbg("first URB failed, easy peasy");
-				free(urbs);
-				tpriv->urbs = NULL;
+				release_urbs(tpriv);
 				return r;
 			}
 
@@ -2289,9 +2374,7 @@ static int submit_control_transfer(struct usbi_transfer *itransfer)
 	if (transfer->length - LIBUSB_CONTROL_SETUP_SIZE > MAX_CTRL_BUFFER_LENGTH)
 		return LIBUSB_ERROR_INVALID_PARAM;
 
-	urb = calloc(1, sizeof(struct usbfs_urb));
-	if (!urb)
-		return LIBUSB_ERROR_NO_MEM;
+	urb = alloc_urbs(tpriv, 1);
 	tpriv->urbs = urb;
 	tpriv->num_urbs = 1;
 	tpriv->reap_action = NORMAL;
@@ -2304,8 +2387,7 @@ static int submit_control_transfer(struct usbi_transfer *itransfer)
 
 	r = ioctl(dpriv->fd, IOCTL_USBFS_SUBMITURB, urb);
 	if (r < 0) {
-		free(urb);
-		tpriv->urbs = NULL;
+		release_urbs(tpriv);
 		if (errno == ENODEV)
 			return LIBUSB_ERROR_NO_DEVICE;
 
@@ -2376,10 +2458,8 @@ static void op_clear_transfer_priv(struct usbi_transfer *itransfer)
 	case LIBUSB_TRANSFER_TYPE_BULK:
 	case LIBUSB_TRANSFER_TYPE_BULK_STREAM:
 	case LIBUSB_TRANSFER_TYPE_INTERRUPT:
-		if (tpriv->urbs) {
-			free(tpriv->urbs);
-			tpriv->urbs = NULL;
-		}
+		if (tpriv->urbs)
+			release_urbs(tpriv);
 		break;
 	case LIBUSB_TRANSFER_TYPE_ISOCHRONOUS:
 		if (tpriv->iso_urbs) {
@@ -2521,8 +2601,7 @@ out_unlock:
 	return 0;
 
 completed:
-	free(tpriv->urbs);
-	tpriv->urbs = NULL;
+	release_urbs(tpriv);
 	usbi_mutex_unlock(&itransfer->lock);
 	return CANCELLED == tpriv->reap_action ?
 		usbi_handle_transfer_cancellation(itransfer) :
@@ -2665,8 +2744,7 @@ static int handle_control_completion(struct usbi_transfer *itransfer,
 		if (urb->status != 0 && urb->status != -ENOENT)
 			usbi_warn(ITRANSFER_CTX(itransfer),
 				"cancel: unrecognised urb status %d", urb->status);
-		free(tpriv->urbs);
-		tpriv->urbs = NULL;
+		release_urbs(tpriv);
 		usbi_mutex_unlock(&itransfer->lock);
 		return usbi_handle_transfer_cancellation(itransfer);
 	}
@@ -2706,8 +2784,7 @@ static int handle_control_completion(struct usbi_transfer *itransfer,
 		break;
 	}
 
-	free(tpriv->urbs);
-	tpriv->urbs = NULL;
+	release_urbs(tpriv);
 	usbi_mutex_unlock(&itransfer->lock);
 	return usbi_handle_transfer_completion(itransfer, status);
 }
@@ -2754,65 +2831,99 @@ static int reap_for_handle(struct libusb_device_handle *handle)
 	}
 }
 
+/* the most URBs reaped from one handle per wakeup. all that have completed
+ * are usually reaped in one pass, but the reaping has to stop somewhere when
+ * completion callbacks resubmit to a device that completes them as fast, or
+ * the other handles and libusb's own fds would wait. URBs left over keep the
+ * fd ready, so they are reaped after the next poll. */
+#define REAP_BUDGET	64
+
+/* reap the URBs that have completed for a handle, up to REAP_BUDGET of them.
+ * returns 1 when there are none left, 0 if the budget ran out, or an error */
+static int reap_batch_for_handle(struct libusb_device_handle *handle)
+{
+	int r = 0;
+	int i;
+
+	for (i = 0; i < REAP_BUDGET; i++) {
+		r = reap_for_handle(handle);
+		if (r != 0)
+			break;
+	}
+	return r;
+}
+
+/* handle the events reported for the fd of an open handle */
+static int handle_fd_events(struct libusb_device_handle *handle, short revents)
+{
+	struct linux_device_handle_priv *hpriv = _device_handle_priv(handle);
+	int r;
+
+	if (revents & POLLERR) {
+		/* remove the fd from the pollfd set so that it doesn't continuously
+		 * trigger an event, and flag that it has been removed so op_close()
+		 * doesn't try to remove it a second time */
+		usbi_remove_pollfd(HANDLE_CTX(handle), hpriv->fd);
+		hpriv->fd_removed = 1;
+
+		/* device will still be marked as attached if hotplug monitor thread
+		 * hasn't processed remove event yet */
+		usbi_mutex_static_lock(&linux_hotplug_lock);
+		if (handle->dev->attached)
+			linux_device_disconnected(handle->dev->bus_number,
+					handle->dev->device_address);
+		usbi_mutex_static_unlock(&linux_hotplug_lock);
+
+		if (hpriv->caps & USBFS_CAP_REAP_AFTER_DISCONNECT) {
+			do {
+				r = reap_for_handle(handle);
+			} while (r == 0);
+		}
+
+		usbi_handle_disconnect(handle);
+		return 0;
+	}
+
+	r = reap_batch_for_handle(handle);
+	if (r >= 0 || r == LIBUSB_ERROR_NO_DEVICE)
+		return 0;
+	return r;
+}
+
+static void op_free_transfer_priv(struct usbi_transfer *itransfer)
+{
+	struct linux_transfer_priv *tpriv = usbi_transfer_get_os_priv(itransfer);
+
+	free(tpriv->spare_urbs);
+}
+
 static int op_handle_events(struct libusb_context *ctx,
 	struct pollfd *fds, POLL_NFDS_TYPE nfds, int num_ready)
 {
+	struct linux_context_priv *cpriv = _context_priv(ctx);
 	int r;
 	unsigned int i = 0;
 
 	usbi_mutex_lock(&ctx->open_devs_lock);
 	for (i = 0; i < nfds && num_ready > 0; i++) {
 		struct pollfd *pollfd = &fds[i];
-		struct libusb_device_handle *handle;
-		struct linux_device_handle_priv *hpriv = NULL;
+		struct libusb_device_handle *handle = NULL;
 
 		if (!pollfd->revents)
 			continue;
 
 		num_ready--;
-		list_for_each_entry(handle, &ctx->open_devs, list, struct libusb_device_handle) {
-			hpriv = _device_handle_priv(handle);
-			if (hpriv->fd == pollfd->fd)
-				break;
-		}
+		if (pollfd->fd < cpriv->fd_handles_size)
+			handle = cpriv->fd_handles[pollfd->fd];
 
-		if (!hpriv || hpriv->fd != pollfd->fd) {
+		if (!handle) {
 			usbi_err(ctx, "cannot find handle for fd %d",
 				 pollfd->fd);
 			continue;
 		}
 
-		if (pollfd->revents & POLLERR) {
-			/* remove the fd from the pollfd set so that it doesn't continuously
-			 * trigger an event, and flag that it has been removed so op_close()
-			 * doesn't try to remove it a second time */
-			usbi_remove_pollfd(HANDLE_CTX(handle), hpriv->fd);
-			hpriv->fd_removed = 1;
-
-			/* device will still be marked as attached if hotplug monitor thread
-			 * hasn't processed remove event yet */
-			usbi_mutex_static_lock(&linux_hotplug_lock);
-			if (handle->dev->attached)
-				linux_device_disconnected(handle->dev->bus_number,
-						handle->dev->device_address);
-			usbi_mutex_static_unlock(&linux_hotplug_lock);
-
-			if (hpriv->caps & USBFS_CAP_REAP_AFTER_DISCONNECT) {
-				do {
-					r = reap_for_handle(handle);
-				} while (r == 0);
-			}
-
-			usbi_handle_disconnect(handle);
-			continue;
-		}
-
-		do {
-			r = reap_for_handle(handle);
-		} while (r == 0);
-		if (r == 1 || r == LIBUSB_ERROR_NO_DEVICE)
-			continue;
-		else if (r < 0)
+		r = handle_fd_events(handle, pollfd->revents);
+		if (r < 0)
 			goto out;
 	}
 
@@ -2822,6 +2933,26 @@ out:
 	return r;
 }
 
+#ifdef USBI_EPOLL_AVAILABLE
+static int op_handle_ready_fds(struct libusb_context *ctx,
+	struct usbi_ready_fd *fds, int nfds)
+{
+	int r = 0;
+	int i;
+
+	/* the handles are known, but hold the lock as op_handle_events() does
+	 * so that the open handles cannot change under a completion */
+	usbi_mutex_lock(&ctx->open_devs_lock);
+	for (i = 0; i < nfds; i++) {
+		r = handle_fd_events(fds[i].user_data, fds[i].revents);
+		if (r < 0)
+			break;
+	}
+	usbi_mutex_unlock(&ctx->open_devs_lock);
+	return r < 0 ? r : 0;
+}
+#endif
+
 static int op_clock_gettime(int clk_id, struct timespec *tp)
 {
 	switch (clk_id) {
@@ -2890,7 +3021,14 @@ const struct usbi_os_backend usbi_backend = {
 	.get_timerfd_clockid = op_get_timerfd_clockid,
 #endif
 
+#ifdef USBI_EPOLL_AVAILABLE
+	.handle_ready_fds = op_handle_ready_fds,
+#endif
+
+	.context_priv_size = sizeof(struct linux_context_priv),
 	.device_priv_size = sizeof(struct linux_device_priv),
 	.device_handle_priv_size = sizeof(struct linux_device_handle_priv),
 	.transfer_priv_size = sizeof(struct linux_transfer_priv),
+
+	.free_transfer_priv = op_free_transfer_priv,
 };
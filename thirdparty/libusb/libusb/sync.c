@@ -111,13 +111,13 @@ int API_EXPORTED libusb_control_transfer(libusb_device_handle *dev_handle,
 	if (usbi_handling_events(HANDLE_CTX(dev_handle)))
 		return LIBUSB_ERROR_BUSY;
 
-	transfer = libusb_alloc_transfer(0);
+	transfer = usbi_alloc_transfer(HANDLE_CTX(dev_handle));
 	if (!transfer)
 		return LIBUSB_ERROR_NO_MEM;
 
 	buffer = (unsigned char*) malloc(LIBUSB_CONTROL_SETUP_SIZE + wLength);
 	if (!buffer) {
-		libusb_free_transfer(transfer);
+		usbi_free_transfer(HANDLE_CTX(dev_handle), transfer);
 		return LIBUSB_ERROR_NO_MEM;
 	}
 
@@ -131,7 +131,7 @@ int API_EXPORTED libusb_control_transfer(libusb_device_handle *dev_handle,
 	transfer->flags = LIBUSB_TRANSFER_FREE_BUFFER;
 	r = libusb_submit_transfer(transfer);
 	if (r < 0) {
-		libusb_free_transfer(transfer);
+		usbi_free_transfer(HANDLE_CTX(dev_handle), transfer);
 		return r;
 	}
 
@@ -167,7 +167,7 @@ int API_EXPORTED libusb_control_transfer(libusb_device_handle *dev_handle,
 		r = LIBUSB_ERROR_OTHER;
 	}
 
-	libusb_free_transfer(transfer);
+	usbi_free_transfer(HANDLE_CTX(dev_handle), transfer);
 	return r;
 }
 
@@ -182,7 +182,7 @@ static int do_sync_bulk_transfer(struct libusb_device_handle *dev_handle,
 	if (usbi_handling_events(HANDLE_CTX(dev_handle)))
 		return LIBUSB_ERROR_BUSY;
 
-	transfer = libusb_alloc_transfer(0);
+	transfer = usbi_alloc_transfer(HANDLE_CTX(dev_handle));
 	if (!transfer)
 		return LIBUSB_ERROR_NO_MEM;
 
@@ -192,7 +192,7 @@ static int do_sync_bulk_transfer(struct libusb_device_handle *dev_handle,
 
 	r = libusb_submit_transfer(transfer);
 	if (r < 0) {
-		libusb_free_transfer(transfer);
+		usbi_free_transfer(HANDLE_CTX(dev_handle), transfer);
 		return r;
 	}
 
@@ -227,7 +227,7 @@ static int do_sync_bulk_transfer(struct libusb_device_handle *dev_handle,
 		r = LIBUSB_ERROR_OTHER;
 	}
 
-	libusb_free_transfer(transfer);
+	usbi_free_transfer(HANDLE_CTX(dev_handle), transfer);
 	return r;
 }
 
@@ -0,0 +1,156 @@
+/*
+ * libusb benchmark of dispatching completions across many open handles
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libusb.h"
+#include "fake_usbfs.h"
+
+/* as many adapters as the feeder supports, each with its two reads */
+#define HANDLES		64
+#define READS		2
+#define COMPLETIONS	400000
+#define PACKET_SIZE	37
+
+struct device {
+	int fd;
+	libusb_device_handle *handle;
+	struct libusb_transfer *transfers[READS];
+	unsigned char buffers[READS][PACKET_SIZE];
+};
+
+static struct device devices[HANDLES];
+static int stopping;
+static int completed;
+static int cancelled;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void LIBUSB_CALL resubmit_cb(struct libusb_transfer *transfer)
+{
+	completed++;
+	if (transfer->status == LIBUSB_TRANSFER_CANCELLED)
+		cancelled++;
+	else if (!stopping)
+		libusb_submit_transfer(transfer);
+}
+
+/* completes one read on each of ready handles per round, starting from a
+ * different handle each time. returns ns per completion, or -1 on error */
+static double run(libusb_context *ctx, int ready)
+{
+	struct timeval zero = { 0, 0 };
+	double start;
+	int round = 0;
+	int i;
+
+	completed = 0;
+	start = now_ns();
+	while (completed < COMPLETIONS) {
+		for (i = 0; i < ready; i++)
+			fake_usbfs_complete(devices[(round + i) % HANDLES].fd, 1);
+		round++;
+		if (libusb_handle_events_timeout_completed(ctx, &zero, NULL) < 0)
+			return -1;
+	}
+	return (now_ns() - start) / completed;
+}
+
+int main(void)
+{
+	libusb_context *ctx = NULL;
+	int ready[] = { 1, 8, HANDLES };
+	int expected = 0;
+	int r, i, j;
+
+	r = libusb_init(&ctx);
+	if (r != LIBUSB_SUCCESS) {
+		fprintf(stderr, "Failed to init libusb: %s\n", libusb_error_name(r));
+		return 1;
+	}
+
+	for (i = 0; i < HANDLES; i++)
+		devices[i].fd = -1;
+	for (i = 0; i < HANDLES; i++) {
+		struct device *dev = &devices[i];
+
+		r = fake_usbfs_wrap(ctx, &dev->fd, &dev->handle);
+		if (r != LIBUSB_SUCCESS) {
+			fprintf(stderr, "Failed to wrap fake device %d: %s\n", i,
+				libusb_error_name(r));
+			goto out;
+		}
+		for (j = 0; j < READS; j++) {
+			dev->transfers[j] = libusb_alloc_transfer(0);
+			if (!dev->transfers[j]) {
+				r = LIBUSB_ERROR_NO_MEM;
+				goto out;
+			}
+			libusb_fill_interrupt_transfer(dev->transfers[j], dev->handle,
+				0x81, dev->buffers[j], PACKET_SIZE, resubmit_cb, NULL, 0);
+			r = libusb_submit_transfer(dev->transfers[j]);
+			if (r != LIBUSB_SUCCESS)
+				goto out;
+		}
+	}
+
+	for (i = 0; i < (int)(sizeof(ready) / sizeof(ready[0])); i++) {
+		double ns = run(ctx, ready[i]);
+
+		if (ns < 0) {
+			r = LIBUSB_ERROR_OTHER;
+			goto out;
+		}
+		printf("%d handles, %2d ready per wakeup: %6.0f ns per completion\n",
+			HANDLES, ready[i], ns);
+	}
+
+out:
+	stopping = 1;
+	cancelled = 0;
+	for (i = 0; i < HANDLES; i++)
+		for (j = 0; j < READS; j++)
+			if (devices[i].transfers[j] &&
+					libusb_cancel_transfer(devices[i].transfers[j]) ==
+					LIBUSB_SUCCESS)
+				expected++;
+	while (cancelled < expected) {
+		struct timeval zero = { 0, 0 };
+
+		if (libusb_handle_events_timeout_completed(ctx, &zero, NULL) < 0)
+			break;
+	}
+	for (i = 0; i < HANDLES; i++) {
+		if (devices[i].handle)
+			libusb_close(devices[i].handle);
+		if (devices[i].fd >= 0)
+			fake_usbfs_close(devices[i].fd);
+		for (j = 0; j < READS; j++)
+			libusb_free_transfer(devices[i].transfers[j]);
+	}
+	libusb_exit(ctx);
+	return r < 0 ? 1 : 0;
+}
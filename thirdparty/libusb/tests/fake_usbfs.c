@@ -0,0 +1,371 @@
+/*
+ * A stand-in for Linux usbfs device nodes, for testing the usbfs backend
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+/* read() is replaced below, which the fortified inline version would hide */
+#undef _FORTIFY_SOURCE
+
+#include <config.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "libusbi.h"
+#include "os/linux_usbfs.h"
+#include "fake_usbfs.h"
+
+#define FAKE_USBFS_MAX_FDS	1024
+#define FAKE_USBFS_MAX_URBS	32768
+
+/* an eventfd is writable until its counter reaches this value */
+#define EVENTFD_FULL	0xfffffffffffffffeULL
+
+struct fake_device {
+	/* URBs in the order they will complete, as rings */
+	struct usbfs_urb *pending[FAKE_USBFS_MAX_URBS];
+	unsigned int pending_head, pending_cnt;
+	struct usbfs_urb *completed[FAKE_USBFS_MAX_URBS];
+	unsigned int completed_head, completed_cnt;
+	off_t offset;
+	int auto_complete;
+	struct fake_usbfs_stats stats;
+};
+
+static const unsigned char descriptors[] = {
+	/* device */
+	0x12, 0x01, 0x00, 0x02, 0x00, 0x00, 0x00, 0x40,
+	0x7e, 0x05, 0x37, 0x03, 0x00, 0x01, 0x00, 0x00, 0x00, 0x01,
+	/* configuration 1 */
+	0x09, 0x02, 0x20, 0x00, 0x01, 0x01, 0x00, 0x80, 0x32,
+	/* interface 0 */
+	0x09, 0x04, 0x00, 0x00, 0x02, 0x03, 0x00, 0x00, 0x00,
+	/* endpoints 0x81 and 0x02 */
+	0x07, 0x05, 0x81, 0x03, 0x40, 0x00, 0x01,
+	0x07, 0x05, 0x02, 0x03, 0x40, 0x00, 0x01,
+};
+
+static pthread_mutex_t fake_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct fake_device *devices[FAKE_USBFS_MAX_FDS];
+
+static struct fake_device *find_device(int fd)
+{
+	if (fd < 0 || fd >= FAKE_USBFS_MAX_FDS)
+		return NULL;
+	return devices[fd];
+}
+
+/* usbfs polls a device as writable while it has URBs to reap */
+static void update_ready(int fd, struct fake_device *dev)
+{
+	uint64_t value = EVENTFD_FULL;
+
+	if (dev->completed_cnt)
+		syscall(SYS_read, fd, &value, sizeof(value));
+	else
+		syscall(SYS_write, fd, &value, sizeof(value));
+}
+
+static void push_completed(struct fake_device *dev, struct usbfs_urb *urb)
+{
+	unsigned int tail = (dev->completed_head + dev->completed_cnt++) %
+		FAKE_USBFS_MAX_URBS;
+
+	dev->completed[tail] = urb;
+}
+
+int fake_usbfs_open(void)
+{
+	struct fake_device *dev;
+	int fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+	if (fd < 0)
+		return -1;
+	if (fd >= FAKE_USBFS_MAX_FDS) {
+		close(fd);
+		return -1;
+	}
+	dev = calloc(1, sizeof(*dev));
+	if (!dev) {
+		close(fd);
+		return -1;
+	}
+
+	pthread_mutex_lock(&fake_lock);
+	devices[fd] = dev;
+	update_ready(fd, dev);
+	pthread_mutex_unlock(&fake_lock);
+	return fd;
+}
+
+void fake_usbfs_close(int fd)
+{
+	struct fake_device *dev;
+
+	pthread_mutex_lock(&fake_lock);
+	dev = find_device(fd);
+	if (dev)
+		devices[fd] = NULL;
+	pthread_mutex_unlock(&fake_lock);
+
+	free(dev);
+	close(fd);
+}
+
+int fake_usbfs_complete(int fd, int count)
+{
+	struct fake_device *dev;
+	int done = 0;
+
+	pthread_mutex_lock(&fake_lock);
+	dev = find_device(fd);
+	while (dev && done < count && dev->pending_cnt) {
+		struct usbfs_urb *urb = dev->pending[dev->pending_head];
+
+		dev->pending_head = (dev->pending_head + 1) % FAKE_USBFS_MAX_URBS;
+		dev->pending_cnt--;
+		/* discarded URBs leave a hole */
+		if (!urb)
+			continue;
+		urb->status = 0;
+		urb->actual_length = urb->buffer_length;
+		push_completed(dev, urb);
+		done++;
+	}
+	if (done)
+		update_ready(fd, dev);
+	pthread_mutex_unlock(&fake_lock);
+	return done;
+}
+
+int fake_usbfs_pending(int fd)
+{
+	struct fake_device *dev;
+	int pending = 0;
+	unsigned int i;
+
+	pthread_mutex_lock(&fake_lock);
+	dev = find_device(fd);
+	for (i = 0; dev && i < dev->pending_cnt; i++)
+		if (dev->pending[(dev->pending_head + i) % FAKE_USBFS_MAX_URBS])
+			pending++;
+	pthread_mutex_unlock(&fake_lock);
+	return pending;
+}
+
+void fake_usbfs_set_auto_complete(int fd, int auto_complete)
+{
+	struct fake_device *dev;
+
+	pthread_mutex_lock(&fake_lock);
+	dev = find_device(fd);
+	if (dev)
+		dev->auto_complete = auto_complete;
+	pthread_mutex_unlock(&fake_lock);
+}
+
+void fake_usbfs_get_stats(int fd, struct fake_usbfs_stats *stats)
+{
+	struct fake_device *dev;
+
+	pthread_mutex_lock(&fake_lock);
+	dev = find_device(fd);
+	if (dev)
+		*stats = dev->stats;
+	else
+		memset(stats, 0, sizeof(*stats));
+	pthread_mutex_unlock(&fake_lock);
+}
+
+int fake_usbfs_wrap(libusb_context *ctx, int *fd,
+	libusb_device_handle **handle)
+{
+	int r;
+
+	*fd = fake_usbfs_open();
+	if (*fd < 0)
+		return LIBUSB_ERROR_NO_MEM;
+	r = libusb_wrap_sys_device(ctx, (intptr_t)*fd, handle);
+	if (r != LIBUSB_SUCCESS)
+		fake_usbfs_close(*fd);
+	return r;
+}
+
+static int fake_ioctl(int fd, struct fake_device *dev, unsigned long request,
+	void *arg)
+{
+	switch (request) {
+	case IOCTL_USBFS_CONNECTINFO: {
+		struct usbfs_connectinfo *ci = arg;
+
+		ci->devnum = (unsigned int)fd;
+		ci->slow = 0;
+		return 0;
+	}
+	case IOCTL_USBFS_GET_CAPABILITIES:
+		*(uint32_t *)arg = USBFS_CAP_ZERO_PACKET |
+			USBFS_CAP_BULK_CONTINUATION | USBFS_CAP_NO_PACKET_SIZE_LIM;
+		return 0;
+	case IOCTL_USBFS_CONTROL: {
+		struct usbfs_ctrltransfer *ctrl = arg;
+
+		/* the only control request made is GET_CONFIGURATION */
+		if (ctrl->wLength)
+			memset(ctrl->data, 1, ctrl->wLength);
+		return ctrl->wLength;
+	}
+	case IOCTL_USBFS_SUBMITURB: {
+		struct usbfs_urb *urb = arg;
+		unsigned int tail;
+
+		if (dev->auto_complete) {
+			if (dev->completed_cnt == FAKE_USBFS_MAX_URBS) {
+				errno = ENOMEM;
+				return -1;
+			}
+			urb->status = 0;
+			urb->actual_length = urb->buffer_length;
+			push_completed(dev, urb);
+			update_ready(fd, dev);
+			dev->stats.submits++;
+			return 0;
+		}
+		if (dev->pending_cnt == FAKE_USBFS_MAX_URBS) {
+			errno = ENOMEM;
+			return -1;
+		}
+		tail = (dev->pending_head + dev->pending_cnt++) %
+			FAKE_USBFS_MAX_URBS;
+		dev->pending[tail] = urb;
+		dev->stats.submits++;
+		return 0;
+	}
+	case IOCTL_USBFS_DISCARDURB: {
+		unsigned int i;
+
+		for (i = 0; i < dev->pending_cnt; i++) {
+			unsigned int pos = (dev->pending_head + i) %
+				FAKE_USBFS_MAX_URBS;
+			struct usbfs_urb *urb = dev->pending[pos];
+
+			if (urb != arg)
+				continue;
+			dev->pending[pos] = NULL;
+			urb->status = -ENOENT;
+			urb->actual_length = 0;
+			push_completed(dev, urb);
+			update_ready(fd, dev);
+			dev->stats.discards++;
+			return 0;
+		}
+		errno = EINVAL;
+		return -1;
+	}
+	case IOCTL_USBFS_REAPURBNDELAY:
+		dev->stats.reaps++;
+		if (!dev->completed_cnt) {
+			dev->stats.empty_reaps++;
+			errno = EAGAIN;
+			return -1;
+		}
+		*(struct usbfs_urb **)arg = dev->completed[dev->completed_head];
+		dev->completed_head = (dev->completed_head + 1) %
+			FAKE_USBFS_MAX_URBS;
+		if (!--dev->completed_cnt)
+			update_ready(fd, dev);
+		return 0;
+	case IOCTL_USBFS_CLAIMINTF:
+	case IOCTL_USBFS_RELEASEINTF:
+	case IOCTL_USBFS_SETINTF:
+	case IOCTL_USBFS_CLEAR_HALT:
+	case IOCTL_USBFS_RESET:
+		return 0;
+	default:
+		errno = ENOTTY;
+		return -1;
+	}
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	struct fake_device *dev;
+	va_list ap;
+	void *arg;
+	int r;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	pthread_mutex_lock(&fake_lock);
+	dev = find_device(fd);
+	if (dev)
+		r = fake_ioctl(fd, dev, request, arg);
+	pthread_mutex_unlock(&fake_lock);
+	if (dev)
+		return r;
+
+	return (int)syscall(SYS_ioctl, fd, request, arg);
+}
+
+ssize_t read(int fd, void *buf, size_t count)
+{
+	struct fake_device *dev;
+	ssize_t r = 0;
+
+	pthread_mutex_lock(&fake_lock);
+	dev = find_device(fd);
+	if (dev && dev->offset < (off_t)sizeof(descriptors)) {
+		r = (ssize_t)sizeof(descriptors) - dev->offset;
+		if ((size_t)r > count)
+			r = (ssize_t)count;
+		memcpy(buf, descriptors + dev->offset, (size_t)r);
+		dev->offset += r;
+	}
+	pthread_mutex_unlock(&fake_lock);
+	if (dev)
+		return r;
+
+	return syscall(SYS_read, fd, buf, count);
+}
+
+off_t lseek(int fd, off_t offset, int whence)
+{
+	struct fake_device *dev;
+
+	pthread_mutex_lock(&fake_lock);
+	dev = find_device(fd);
+	if (dev) {
+		if (whence == SEEK_SET)
+			dev->offset = offset;
+		else
+			dev->offset += offset;
+		offset = dev->offset;
+	}
+	pthread_mutex_unlock(&fake_lock);
+	if (dev)
+		return offset;
+
+	return syscall(SYS_lseek, fd, offset, whence);
+}
@@ -0,0 +1,61 @@
+/*
+ * A stand-in for Linux usbfs device nodes, for testing the usbfs backend
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#ifndef FAKE_USBFS_H
+#define FAKE_USBFS_H
+
+#include "libusb.h"
+
+/* Linking this in replaces ioctl(), read() and lseek() for the fds it hands
+ * out. Such an fd passed to libusb_wrap_sys_device() looks to the usbfs
+ * backend like a device with one interface, interrupt endpoints 0x81 and
+ * 0x02, and a 64 byte max packet size. Submitted URBs stay pending until
+ * fake_usbfs_complete() or a discard, and the fd polls as writable while
+ * there are URBs to reap, as usbfs does. Other fds go to the real calls. */
+
+struct fake_usbfs_stats {
+	unsigned long submits;
+	unsigned long discards;
+	/* REAPURBNDELAY calls, and those of them that found nothing */
+	unsigned long reaps;
+	unsigned long empty_reaps;
+};
+
+/* Returns a new fake device fd, or -1 on failure. */
+int fake_usbfs_open(void);
+void fake_usbfs_close(int fd);
+
+/* Completes up to count of the oldest pending URBs, successfully and with
+ * their full length. Returns the number completed. */
+int fake_usbfs_complete(int fd, int count);
+
+/* Returns the number of URBs submitted and not yet completed or discarded. */
+int fake_usbfs_pending(int fd);
+
+/* With auto_complete set, URBs complete as soon as they are submitted, as
+ * fake_usbfs_complete() would, so that the synchronous API can be used. */
+void fake_usbfs_set_auto_complete(int fd, int auto_complete);
+
+void fake_usbfs_get_stats(int fd, struct fake_usbfs_stats *stats);
+
+/* Opens a fake device and wraps it in a handle. Returns a libusb error code;
+ * close the handle before passing the fd to fake_usbfs_close(). */
+int fake_usbfs_wrap(libusb_context *ctx, int *fd,
+	libusb_device_handle **handle);
+
+#endif
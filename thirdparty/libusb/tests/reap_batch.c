@@ -0,0 +1,179 @@
+/*
+ * libusb test of how many URBs the usbfs backend reaps per wakeup
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+
+#include "libusb.h"
+#include "fake_usbfs.h"
+
+/* must match REAP_BUDGET in the usbfs backend */
+#define BUDGET		64
+#define TRANSFERS	200
+#define PACKET_SIZE	37
+
+struct device {
+	int fd;
+	libusb_device_handle *handle;
+	struct libusb_transfer *transfers[TRANSFERS];
+	unsigned char buffers[TRANSFERS][PACKET_SIZE];
+	int completed;
+	struct fake_usbfs_stats last;
+};
+
+static struct device devices[2];
+static int stopping;
+static int cancelled;
+static int failures;
+
+static void LIBUSB_CALL resubmit_cb(struct libusb_transfer *transfer)
+{
+	struct device *dev = transfer->user_data;
+
+	if (transfer->status == LIBUSB_TRANSFER_CANCELLED) {
+		cancelled++;
+		return;
+	}
+	dev->completed++;
+	if (!stopping)
+		libusb_submit_transfer(transfer);
+}
+
+/* handles one wakeup, and checks what each device had reaped in it */
+static void wakeup(libusb_context *ctx, const char *what,
+	const int expected[2][3])
+{
+	struct timeval zero = { 0, 0 };
+	int i;
+
+	for (i = 0; i < 2; i++)
+		devices[i].completed = 0;
+	if (libusb_handle_events_timeout_completed(ctx, &zero, NULL) < 0) {
+		printf("%s: event handling failed\n", what);
+		failures++;
+		return;
+	}
+
+	for (i = 0; i < 2; i++) {
+		struct device *dev = &devices[i];
+		struct fake_usbfs_stats stats;
+		int reaps, empty_reaps;
+
+		fake_usbfs_get_stats(dev->fd, &stats);
+		reaps = (int)(stats.reaps - dev->last.reaps);
+		empty_reaps = (int)(stats.empty_reaps - dev->last.empty_reaps);
+		dev->last = stats;
+		if (dev->completed != expected[i][0] || reaps != expected[i][1] ||
+				empty_reaps != expected[i][2]) {
+			printf("%s: device %d completed %d with %d reaps, %d empty;"
+				" expected %d with %d, %d empty\n", what, i,
+				dev->completed, reaps, empty_reaps, expected[i][0],
+				expected[i][1], expected[i][2]);
+			failures++;
+		}
+	}
+}
+
+int main(void)
+{
+	/* per device: completions, REAPURBNDELAY calls, and of those empty */
+	static const int together[2][3] = { { 10, 11, 1 }, { 3, 4, 1 } };
+	static const int flood[2][3] = { { BUDGET, BUDGET, 0 }, { 5, 6, 1 } };
+	static const int rest[2][3] = { { BUDGET, BUDGET, 0 }, { 0, 0, 0 } };
+	static const int last[2][3] = { { 150 - 2 * BUDGET, 150 - 2 * BUDGET + 1,
+		1 }, { 0, 0, 0 } };
+	libusb_context *ctx = NULL;
+	int expected = 0;
+	int r, i, j;
+
+	r = libusb_init(&ctx);
+	if (r != LIBUSB_SUCCESS) {
+		printf("Failed to init libusb: %s\n", libusb_error_name(r));
+		return 1;
+	}
+
+	for (i = 0; i < 2; i++)
+		devices[i].fd = -1;
+	for (i = 0; i < 2; i++) {
+		struct device *dev = &devices[i];
+
+		r = fake_usbfs_wrap(ctx, &dev->fd, &dev->handle);
+		if (r != LIBUSB_SUCCESS) {
+			printf("Failed to wrap a fake device: %s\n",
+				libusb_error_name(r));
+			goto out;
+		}
+		for (j = 0; j < TRANSFERS; j++) {
+			dev->transfers[j] = libusb_alloc_transfer(0);
+			if (!dev->transfers[j]) {
+				r = LIBUSB_ERROR_NO_MEM;
+				goto out;
+			}
+			libusb_fill_interrupt_transfer(dev->transfers[j], dev->handle,
+				0x81, dev->buffers[j], PACKET_SIZE, resubmit_cb, dev, 0);
+			r = libusb_submit_transfer(dev->transfers[j]);
+			if (r != LIBUSB_SUCCESS)
+				goto out;
+		}
+	}
+
+	/* everything that completed together is reaped in one pass, with one
+	 * REAPURBNDELAY call to find there is no more */
+	fake_usbfs_complete(devices[0].fd, 10);
+	fake_usbfs_complete(devices[1].fd, 3);
+	wakeup(ctx, "completed together", together);
+
+	/* a device with more than the budget does not hold up the other one, and
+	 * the rest of its URBs are reaped in the following wakeups */
+	fake_usbfs_complete(devices[0].fd, 150);
+	fake_usbfs_complete(devices[1].fd, 5);
+	wakeup(ctx, "over the budget", flood);
+	wakeup(ctx, "second wakeup", rest);
+	wakeup(ctx, "third wakeup", last);
+
+out:
+	stopping = 1;
+	cancelled = 0;
+	for (i = 0; i < 2; i++)
+		for (j = 0; j < TRANSFERS; j++)
+			if (devices[i].transfers[j] &&
+					libusb_cancel_transfer(devices[i].transfers[j]) ==
+					LIBUSB_SUCCESS)
+				expected++;
+	while (cancelled < expected) {
+		struct timeval zero = { 0, 0 };
+
+		if (libusb_handle_events_timeout_completed(ctx, &zero, NULL) < 0)
+			break;
+	}
+	for (i = 0; i < 2; i++) {
+		if (devices[i].handle)
+			libusb_close(devices[i].handle);
+		if (devices[i].fd >= 0)
+			fake_usbfs_close(devices[i].fd);
+		for (j = 0; j < TRANSFERS; j++)
+			libusb_free_transfer(devices[i].transfers[j]);
+	}
+	libusb_exit(ctx);
+
+	if (r < 0 || failures) {
+		printf("FAILED\n");
+		return 1;
+	}
+	printf("OK\n");
+	return 0;
+}
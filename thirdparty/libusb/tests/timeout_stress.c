@@ -0,0 +1,204 @@
+/*
+ * libusb stress test of transfer timeout bookkeeping with many transfers
+ * in flight at once
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libusb.h"
+#include "fake_usbfs.h"
+
+/* completions per round, as from one frame of 64 adapters */
+#define BATCH		64
+#define COMPLETIONS	200000
+#define PACKET_SIZE	37
+
+static int stopping;
+static int completed;
+static int cancelled;
+static int probe_status;
+static int probe_done;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* like an always-in-flight interrupt read, resubmit on completion */
+static void LIBUSB_CALL resubmit_cb(struct libusb_transfer *transfer)
+{
+	completed++;
+	if (transfer->status == LIBUSB_TRANSFER_CANCELLED)
+		cancelled++;
+	else if (!stopping)
+		libusb_submit_transfer(transfer);
+}
+
+static void LIBUSB_CALL probe_cb(struct libusb_transfer *transfer)
+{
+	if (transfer->status == LIBUSB_TRANSFER_CANCELLED)
+		cancelled++;
+	probe_status = transfer->status;
+	probe_done = 1;
+}
+
+static int run(int count)
+{
+	libusb_context *ctx = NULL;
+	libusb_device_handle *handle = NULL;
+	struct libusb_transfer **transfers;
+	struct libusb_transfer *probe = NULL;
+	unsigned char *buffers;
+	struct timeval zero = { 0, 0 };
+	struct timeval second = { 1, 0 };
+	double start, submit_ns, cycle_ns, fired_ms;
+	int fd = -1;
+	int expected;
+	int r, i;
+
+	transfers = calloc(count, sizeof(*transfers));
+	buffers = malloc((size_t)count * PACKET_SIZE);
+	if (!transfers || !buffers) {
+		r = LIBUSB_ERROR_NO_MEM;
+		goto out;
+	}
+
+	r = libusb_init(&ctx);
+	if (r != LIBUSB_SUCCESS) {
+		fprintf(stderr, "Failed to init libusb: %s\n", libusb_error_name(r));
+		goto out;
+	}
+	r = fake_usbfs_wrap(ctx, &fd, &handle);
+	if (r != LIBUSB_SUCCESS) {
+		fprintf(stderr, "Failed to wrap a fake device: %s\n",
+			libusb_error_name(r));
+		goto out;
+	}
+
+	/* distinct timeouts between 1 and 5 seconds, in no particular order */
+	for (i = 0; i < count; i++) {
+		transfers[i] = libusb_alloc_transfer(0);
+		if (!transfers[i]) {
+			r = LIBUSB_ERROR_NO_MEM;
+			goto out;
+		}
+		libusb_fill_interrupt_transfer(transfers[i], handle, 0x81,
+			buffers + (size_t)i * PACKET_SIZE, PACKET_SIZE, resubmit_cb,
+			NULL, 1000 + (unsigned int)(i * 7919) % 4000);
+	}
+
+	stopping = 0;
+	start = now_ns();
+	for (i = 0; i < count; i++) {
+		r = libusb_submit_transfer(transfers[i]);
+		if (r != LIBUSB_SUCCESS) {
+			fprintf(stderr, "Failed to submit transfer %d: %s\n", i,
+				libusb_error_name(r));
+			goto out;
+		}
+	}
+	submit_ns = (now_ns() - start) / count;
+
+	/* complete the oldest transfers in batches. each is resubmitted from its
+	 * callback, which moves its timeout to the back of the queue */
+	completed = 0;
+	start = now_ns();
+	while (completed < COMPLETIONS) {
+		fake_usbfs_complete(fd, BATCH);
+		r = libusb_handle_events_timeout_completed(ctx, &zero, NULL);
+		if (r < 0)
+			goto out;
+	}
+	cycle_ns = (now_ns() - start) / completed;
+
+	/* a short timeout behind all of those must still arm the timer */
+	probe = libusb_alloc_transfer(0);
+	if (!probe) {
+		r = LIBUSB_ERROR_NO_MEM;
+		goto out;
+	}
+	libusb_fill_interrupt_transfer(probe, handle, 0x81, buffers, PACKET_SIZE,
+		probe_cb, NULL, 20);
+	probe_done = 0;
+	start = now_ns();
+	r = libusb_submit_transfer(probe);
+	while (r == LIBUSB_SUCCESS && !probe_done)
+		r = libusb_handle_events_timeout_completed(ctx, &second, &probe_done);
+	fired_ms = (now_ns() - start) / 1e6;
+	if (r < 0)
+		goto out;
+	if (probe_status != LIBUSB_TRANSFER_TIMED_OUT) {
+		fprintf(stderr, "Short timeout completed with status %d\n",
+			probe_status);
+		r = LIBUSB_ERROR_OTHER;
+		goto out;
+	}
+
+	printf("%6d in flight: %6.0f ns per submit, %6.0f ns per completion"
+		" and resubmit, 20 ms timeout fired after %.1f ms\n",
+		count, submit_ns, cycle_ns, fired_ms);
+
+out:
+	/* cancel everything still in flight and let the cancellations finish */
+	stopping = 1;
+	if (handle) {
+		expected = 0;
+		cancelled = 0;
+		for (i = 0; transfers && i < count && transfers[i]; i++)
+			if (libusb_cancel_transfer(transfers[i]) == LIBUSB_SUCCESS)
+				expected++;
+		if (probe && libusb_cancel_transfer(probe) == LIBUSB_SUCCESS)
+			expected++;
+		while (cancelled < expected &&
+				libusb_handle_events_timeout_completed(ctx, &zero, NULL) == 0)
+			;
+		libusb_close(handle);
+	}
+	if (fd >= 0)
+		fake_usbfs_close(fd);
+	for (i = 0; transfers && i < count; i++)
+		libusb_free_transfer(transfers[i]);
+	libusb_free_transfer(probe);
+	if (ctx)
+		libusb_exit(ctx);
+	free(transfers);
+	free(buffers);
+	return r;
+}
+
+int main(int argc, char **argv)
+{
+	int counts[] = { 1000, 10000 };
+	int i;
+
+	if (argc > 1) {
+		for (i = 1; i < argc; i++)
+			if (run(atoi(argv[i])) < 0)
+				return 1;
+		return 0;
+	}
+
+	for (i = 0; i < (int)(sizeof(counts) / sizeof(counts[0])); i++)
+		if (run(counts[i]) < 0)
+			return 1;
+	return 0;
+}
@@ -0,0 +1,175 @@
+/*
+ * libusb benchmark of the cost of allocating and submitting a transfer
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "libusb.h"
+#include "fake_usbfs.h"
+
+#define ROUNDS		200000
+#define PACKET_SIZE	37
+/* split into three URBs, as usbfs takes at most 16 KB in each */
+#define BULK_SIZE	40000
+
+static int done;
+
+static double now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static void LIBUSB_CALL done_cb(struct libusb_transfer *transfer)
+{
+	(void)transfer;
+	done = 1;
+}
+
+/* submit one read, complete all of its URBs and handle the completion */
+static int round_trip(libusb_context *ctx, int fd,
+	struct libusb_transfer *transfer)
+{
+	struct timeval zero = { 0, 0 };
+	int r;
+
+	done = 0;
+	r = libusb_submit_transfer(transfer);
+	if (r != LIBUSB_SUCCESS)
+		return r;
+	fake_usbfs_complete(fd, fake_usbfs_pending(fd));
+	while (r == LIBUSB_SUCCESS && !done)
+		r = libusb_handle_events_timeout_completed(ctx, &zero, &done);
+	if (r == LIBUSB_SUCCESS && (transfer->status !=
+			LIBUSB_TRANSFER_COMPLETED || transfer->actual_length !=
+			transfer->length)) {
+		fprintf(stderr, "Read ended with status %d after %d of %d bytes\n",
+			transfer->status, transfer->actual_length, transfer->length);
+		r = LIBUSB_ERROR_OTHER;
+	}
+	return r;
+}
+
+/* returns ns per read, with a new transfer for every read as the synchronous
+ * API does if fresh is set, or with one transfer resubmitted otherwise */
+static double reads(libusb_context *ctx, int fd, libusb_device_handle *handle,
+	unsigned char type, unsigned char *buffer, int length, int fresh)
+{
+	struct libusb_transfer *transfer = NULL;
+	double start;
+	int r = LIBUSB_SUCCESS;
+	int i;
+
+	start = now_ns();
+	for (i = 0; i < ROUNDS && r == LIBUSB_SUCCESS; i++) {
+		if (!transfer) {
+			transfer = libusb_alloc_transfer(0);
+			if (!transfer)
+				return -1;
+			libusb_fill_bulk_transfer(transfer, handle, 0x81, buffer, length,
+				done_cb, NULL, 1000);
+			transfer->type = type;
+		}
+		r = round_trip(ctx, fd, transfer);
+		if (fresh) {
+			libusb_free_transfer(transfer);
+			transfer = NULL;
+		}
+	}
+	libusb_free_transfer(transfer);
+	return r == LIBUSB_SUCCESS ? (now_ns() - start) / ROUNDS : -1;
+}
+
+/* returns ns per read through the synchronous API, which takes its transfers
+ * from the context's pool */
+static double sync_reads(int fd, libusb_device_handle *handle,
+	unsigned char type, unsigned char *buffer, int length)
+{
+	double start;
+	int transferred = 0;
+	int r = LIBUSB_SUCCESS;
+	int i;
+
+	fake_usbfs_set_auto_complete(fd, 1);
+	start = now_ns();
+	for (i = 0; i < ROUNDS && r == LIBUSB_SUCCESS; i++) {
+		if (type == LIBUSB_TRANSFER_TYPE_BULK)
+			r = libusb_bulk_transfer(handle, 0x81, buffer, length,
+				&transferred, 1000);
+		else
+			r = libusb_interrupt_transfer(handle, 0x81, buffer, length,
+				&transferred, 1000);
+		if (r == LIBUSB_SUCCESS && transferred != length) {
+			fprintf(stderr, "Read ended after %d of %d bytes\n",
+				transferred, length);
+			r = LIBUSB_ERROR_OTHER;
+		}
+	}
+	fake_usbfs_set_auto_complete(fd, 0);
+	return r == LIBUSB_SUCCESS ? (now_ns() - start) / ROUNDS : -1;
+}
+
+int main(void)
+{
+	libusb_context *ctx = NULL;
+	libusb_device_handle *handle = NULL;
+	static unsigned char buffer[BULK_SIZE];
+	double ns[2][3];
+	int sizes[2] = { PACKET_SIZE, BULK_SIZE };
+	unsigned char types[2] = {
+		LIBUSB_TRANSFER_TYPE_INTERRUPT, LIBUSB_TRANSFER_TYPE_BULK
+	};
+	int fd = -1;
+	int r, i;
+
+	r = libusb_init(&ctx);
+	if (r != LIBUSB_SUCCESS) {
+		fprintf(stderr, "Failed to init libusb: %s\n", libusb_error_name(r));
+		return 1;
+	}
+	r = fake_usbfs_wrap(ctx, &fd, &handle);
+	if (r != LIBUSB_SUCCESS) {
+		fprintf(stderr, "Failed to wrap a fake device: %s\n",
+			libusb_error_name(r));
+		goto out;
+	}
+
+	for (i = 0; i < 2; i++) {
+		ns[i][0] = sync_reads(fd, handle, types[i], buffer, sizes[i]);
+		ns[i][1] = reads(ctx, fd, handle, types[i], buffer, sizes[i], 1);
+		ns[i][2] = reads(ctx, fd, handle, types[i], buffer, sizes[i], 0);
+		if (ns[i][0] < 0 || ns[i][1] < 0 || ns[i][2] < 0) {
+			r = LIBUSB_ERROR_OTHER;
+			goto out;
+		}
+		printf("%5d byte read: %5.0f ns synchronous, %5.0f ns with a new"
+			" transfer, %5.0f ns with a reused one\n", sizes[i], ns[i][0],
+			ns[i][1], ns[i][2]);
+	}
+
+out:
+	if (handle)
+		libusb_close(handle);
+	if (fd >= 0)
+		fake_usbfs_close(fd);
+	libusb_exit(ctx);
+	return r < 0 ? 1 : 0;
+}